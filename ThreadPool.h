@@ -2,92 +2,257 @@
 #define THREAD_POOL_H
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
-#include <functional>
 #include <stdexcept>
+#include <tuple>
+
+#include "task_function.h"
 
 class ThreadPool {
 public:
     ThreadPool(size_t);
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
+    auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+    // fire and forget: no future, no shared state; f must not throw
+    template<class F, class... Args>
+    void post(F&& f, Args&&... args);
+    // runs a here and b wherever a thread is free, and returns once both
+    // are done; b lives on this stack frame, so no allocation or future.
+    template<class A, class B>
+    void join(A&& a, B&& b);
+    size_t size() const { return workers.size(); }
     ~ThreadPool();
 private:
+    // one deque per worker, owner pushes and pops at the back (LIFO)
+    // and thieves take from the front; the last one takes submissions
+    // from threads outside the pool.
+    struct alignas(64) task_queue {
+        std::mutex mutex;
+        std::deque< lm2::task_function > tasks;
+    };
+
+    template<class R, class G>
+    static void fulfil(std::promise<R> & promise, G & g)
+        { promise.set_value(g()); }
+    template<class G>
+    static void fulfil(std::promise<void> & promise, G & g)
+        { g(); promise.set_value(); }
+
+    template<class B>
+    struct join_frame {
+        B & b;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+        void run()
+        {
+            try {
+                b();
+            } catch(...) {
+                error = std::current_exception();
+            }
+            done.store(true, std::memory_order_release);
+        }
+    };
+
+    struct worker_info {
+        ThreadPool * pool;
+        size_t index;
+        unsigned seed;
+    };
+    static worker_info & current()
+    {
+        thread_local worker_info info = {nullptr, 0, 0};
+        return info;
+    }
+    size_t self() const
+        { return current().pool == this ? current().index : workers.size(); }
+
+    void push(lm2::task_function && task);
+    bool pop(size_t index, lm2::task_function & task);
+    bool steal(size_t index, lm2::task_function & task);
+    bool run_one(size_t index);
+    void work(size_t index);
+
     // need to keep track of threads so we can join them
     std::vector< std::thread > workers;
-    // the task queue
-    std::queue< std::function<void()> > tasks;
-    
+    std::vector< std::unique_ptr<task_queue> > queues;
+
     // synchronization
-    std::mutex queue_mutex;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> sleepers;
+    std::mutex sleep_mutex;
     std::condition_variable condition;
-    bool stop;
+    std::atomic<bool> stop;
 };
- 
+
 // the constructor just launches some amount of workers
 inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
+    :   pending(0), sleepers(0), stop(false)
 {
+    for(size_t i = 0;i<=threads;++i)
+        queues.emplace_back(new task_queue);
     for(size_t i = 0;i<threads;++i)
         workers.emplace_back(
-            [this]
+            [this, i]
             {
-                for(;;)
-                {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-
-                    task();
-                }
+                current() = {this, i, unsigned(i) * 2654435761u + 1};
+                work(i);
             }
         );
 }
 
-// add new work item to the pool
+inline void ThreadPool::push(lm2::task_function && task)
+{
+    task_queue & queue = *queues[self()];
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    pending.fetch_add(1);
+    // pairs with the sleepers/pending check in work()
+    if(sleepers.load())
+    {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        condition.notify_one();
+    }
+}
+
+inline bool ThreadPool::pop(size_t index, lm2::task_function & task)
+{
+    task_queue & queue = *queues[index];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if(queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    pending.fetch_sub(1);
+    return true;
+}
+
+inline bool ThreadPool::steal(size_t index, lm2::task_function & task)
+{
+    unsigned & seed = current().seed;
+    seed = seed * 1103515245u + 12345u;
+    size_t count = queues.size();
+    size_t start = (seed >> 8) % count;
+    for(size_t i = 0;i<count;++i)
+    {
+        size_t victim = (start + i) % count;
+        if(victim == index)
+            continue;
+        task_queue & queue = *queues[victim];
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        if(queue.tasks.empty())
+            continue;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        pending.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+inline bool ThreadPool::run_one(size_t index)
+{
+    lm2::task_function task;
+    if(!pop(index, task) && !steal(index, task))
+        return false;
+    task();
+    return true;
+}
+
+inline void ThreadPool::work(size_t index)
+{
+    for(;;)
+    {
+        if(run_one(index))
+            continue;
+        std::unique_lock<std::mutex> lock(this->sleep_mutex);
+        sleepers.fetch_add(1);
+        this->condition.wait(lock,
+            [this]{ return this->stop || this->pending.load() > 0; });
+        sleepers.fetch_sub(1);
+        if(this->stop && this->pending.load() == 0)
+            return;
+    }
+}
+
+// add new work item to the pool; the task and the future's shared
+// state both come out of lm2 memory pools
 template<class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&&... args) 
+auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type>
 {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
-        
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+    // don't allow enqueueing after stopping the pool
+    if(stop)
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+
+    std::promise<return_type> promise(std::allocator_arg, lm2::pool_allocator<char>());
+    std::future<return_type> res = promise.get_future();
+    push([promise = std::move(promise), f = std::forward<F>(f),
+            args = std::make_tuple(std::forward<Args>(args)...)]() mutable
+        {
+            auto call = [&]() -> return_type { return std::apply(f, std::move(args)); };
+            try {
+                fulfil(promise, call);
+            } catch(...) {
+                promise.set_exception(std::current_exception());
+            }
+        });
+    return res;
+}
+
+template<class F, class... Args>
+void ThreadPool::post(F&& f, Args&&... args)
+{
+    if(stop)
+        throw std::runtime_error("post on stopped ThreadPool");
+
+    push([f = std::forward<F>(f),
+            args = std::make_tuple(std::forward<Args>(args)...)]() mutable noexcept
+        {
+            std::apply(f, std::move(args));
+        });
+}
 
-        // don't allow enqueueing after stopping the pool
-        if(stop)
-            throw std::runtime_error("enqueue on stopped ThreadPool");
+template<class A, class B>
+void ThreadPool::join(A&& a, B&& b)
+{
+    join_frame<B> frame = {b, {false}, nullptr};
+    push([&frame](){ frame.run(); });
 
-        tasks.emplace([task](){ (*task)(); });
+    std::exception_ptr error;
+    try {
+        a();
+    } catch(...) {
+        error = std::current_exception();
     }
-    condition.notify_one();
-    return res;
+    // b is either still queued here, and comes back off the back of
+    // our own deque, or a thief is running it; help out meanwhile.
+    size_t index = self();
+    while(!frame.done.load(std::memory_order_acquire))
+        if(!run_one(index))
+            std::this_thread::yield();
+    if(error)
+        std::rethrow_exception(error);
+    if(frame.error)
+        std::rethrow_exception(frame.error);
 }
 
 // the destructor joins all threads
 inline ThreadPool::~ThreadPool()
 {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::unique_lock<std::mutex> lock(sleep_mutex);
         stop = true;
     }
     condition.notify_all();
@@ -95,4 +260,4 @@ inline ThreadPool::~ThreadPool()
         worker.join();
 }
 
-#endif
\ No newline at end of file
+#endif
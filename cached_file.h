@@ -0,0 +1,474 @@
+//
+//  cached_file.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef cached_file_h
+#define cached_file_h
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <typeinfo>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cached_ptr.h"
+#include "linear_move_2.h"
+
+namespace lm2 {
+
+// identifies T on disk. the default hashes the mangled name, which one
+// compiler keeps stable; specialize it to outlive a rename of T.
+template <class T>
+struct file_type_tag {
+	static uint64_t value ()
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (const char * p = typeid (T).name (); *p; p++)
+			hash = (hash ^ (unsigned char) *p) * 1099511628211ull;
+		return hash;
+	}
+};
+
+// a file is this header, then size elements at data_offset, aligned for
+// T and to a cache line, exactly as they lay in the node.
+struct file_header {
+	char magic [8];
+	uint32_t version;
+	uint32_t elem_size;
+	uint64_t type_tag;
+	uint64_t size;
+	uint64_t capacity;
+	uint64_t align;
+	uint64_t data_offset;
+};
+
+constexpr char file_magic [8] = {'l', 'm', '2', 'v', 'e', 'c', '\n', 0};
+constexpr uint32_t file_version = 1;
+
+template <class T>
+constexpr size_t file_data_offset ()
+{
+	return alignof (T) > cache_line_size ?
+		(sizeof (file_header) + alignof (T) - 1) / alignof (T) * alignof (T) :
+		(sizeof (file_header) + cache_line_size - 1) / cache_line_size * cache_line_size;
+}
+
+template <class T, size_t C>
+size_t capacity_of (const cached_ptr<T,C> &)
+	{ return C; }
+
+template <class T>
+size_t capacity_of (const cached_ptr<T,growable> & vec)
+	{ return vec.capacity(); }
+
+template <class T>
+file_header make_file_header (size_t size, size_t capacity)
+{
+	file_header header = {};
+	memcpy (header.magic, file_magic, sizeof (file_magic));
+	header.version = file_version;
+	header.elem_size = sizeof (T);
+	header.type_tag = file_type_tag<T>::value ();
+	header.size = size;
+	header.capacity = capacity;
+	header.align = alignof (T);
+	header.data_offset = file_data_offset<T> ();
+	return header;
+}
+
+// whether a file written for some cached_ptr<T,C2> fits a cached_ptr<T,C>
+// and its elements lie within length bytes.
+template <class T, size_t C>
+bool check_file_header (const file_header & header, size_t length)
+{
+	return !memcmp (header.magic, file_magic, sizeof (file_magic)) &&
+		header.version == file_version &&
+		header.elem_size == sizeof (T) &&
+		header.type_tag == file_type_tag<T>::value () &&
+		header.align == alignof (T) &&
+		header.data_offset == file_data_offset<T> () &&
+		(C == growable || header.size <= C) &&
+		header.size <= (length - header.data_offset) / sizeof (T);
+}
+
+// writes every byte of iov, going round again after short writes.
+inline bool write_all (int fd, iovec * iov, int cnt)
+{
+	while (cnt) {
+		ssize_t done = writev (fd, iov, cnt);
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		for (; cnt && size_t (done) >= iov->iov_len; iov++, cnt--)
+			done -= iov->iov_len;
+		if (cnt) {
+			iov->iov_base = (char *) iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return true;
+}
+
+inline bool read_all (int fd, void * dst, size_t len, off_t pos)
+{
+	while (len) {
+		ssize_t done = pread (fd, dst, len, pos);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			return false;
+		dst = (char *) dst + done;
+		len -= done;
+		pos += done;
+	}
+	return true;
+}
+
+// one writev: the header, its padding and the elements straight out of
+// the node, without a copy.
+template <class T, size_t C>
+bool write_file (int fd, const cached_ptr<T,C> & vec)
+{
+	static_assert (std::is_trivially_copyable<T>::value, "only trivially copyable elements go to disk as they are");
+	static const char padding [file_data_offset<T> ()] = {};
+	file_header header = make_file_header<T> (vec.size(), capacity_of (vec));
+	iovec iov [3] = {
+		{&header, sizeof (header)},
+		{(void *) padding, file_data_offset<T> () - sizeof (header)},
+		{(void *) vec.data(), vec.size() * sizeof (T)},
+	};
+	return write_all (fd, iov, 3);
+}
+
+template <class T, size_t C>
+bool save_file (const char * path, const cached_ptr<T,C> & vec)
+{
+	int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	bool ret = write_file (fd, vec);
+	return close (fd) == 0 && ret;
+}
+
+// reads the elements straight into a fresh node, which replaces vec's
+// contents only once all of them are in; on failure vec is unchanged.
+template <class T, size_t C>
+bool read_file (int fd, cached_ptr<T,C> & vec)
+{
+	static_assert (std::is_trivially_copyable<T>::value, "only trivially copyable elements come from disk as they are");
+	struct stat st;
+	file_header header;
+	if (fstat (fd, &st) || size_t (st.st_size) < file_data_offset<T> () ||
+			!read_all (fd, &header, sizeof (header), 0) ||
+			!check_file_header<T, C> (header, st.st_size))
+		return false;
+	cached_ptr<T,C> ret;
+	ret.reserve (header.size);
+	if (!read_all (fd, ret.data(), header.size * sizeof (T), header.data_offset))
+		return false;
+	ret.resize_uninitialized (header.size);
+	vec = std::move (ret);
+	return true;
+}
+
+template <class T, size_t C>
+bool load_file (const char * path, cached_ptr<T,C> & vec)
+{
+	int fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	bool ret = read_file (fd, vec);
+	close (fd);
+	return ret;
+}
+
+// read-only view of a file write_file wrote; the elements are used where
+// the page cache holds them, so opening one deserializes nothing. it has
+// the const side of cached_ptr, and the read-only algorithms below take
+// it as it is; the rest need copy ().
+template <class T, size_t C = growable>
+class mapped_ptr {
+	void * base;
+	size_t length;
+	const T * memory;
+	size_t len;
+public:
+	mapped_ptr ()
+	: base (nullptr), length (0), memory (nullptr), len (0)
+		{}
+	mapped_ptr (void * base, size_t length, const T * memory, size_t len)
+	: base (base), length (length), memory (memory), len (len)
+		{}
+	mapped_ptr (mapped_ptr && self) noexcept
+	: base (self.base), length (self.length), memory (self.memory), len (self.len)
+		{ self.base = nullptr; }
+	mapped_ptr & operator = (mapped_ptr && self)
+	{
+		std::swap (base, self.base);
+		std::swap (length, self.length);
+		memory = self.memory;
+		len = self.len;
+		return *this;
+	}
+	~mapped_ptr ()
+	{
+		if (base)
+			munmap (base, length);
+	}
+	explicit operator bool () const
+		{ return base; }
+	size_t size () const
+		{ return len; }
+	const T * data () const
+		{ return memory; }
+	const T & operator [] (size_t pos) const
+		{ assert (pos < len); return memory [pos]; }
+	const T * begin () const
+		{ return memory; }
+	const T * end () const
+		{ return memory + len; }
+	// a writable cached_ptr with the same elements, in one memcpy.
+	cached_ptr<T,C> copy () const
+	{
+		cached_ptr<T,C> ret;
+		ret.reserve (len);
+		if (len)
+			memcpy ((void *) ret.data(), memory, len * sizeof (T));
+		ret.resize_uninitialized (len);
+		return std::move (ret);
+	}
+};
+
+// an empty, false view when the file is missing or was written for
+// another element type, or holds more than C elements.
+template <class T, size_t C = growable>
+mapped_ptr<T,C> map_file (const char * path)
+{
+	static_assert (std::is_trivially_copyable<T>::value, "only trivially copyable elements come from disk as they are");
+	int fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return {};
+	struct stat st;
+	if (fstat (fd, &st) || size_t (st.st_size) < file_data_offset<T> ()) {
+		close (fd);
+		return {};
+	}
+	size_t length = st.st_size;
+	void * base = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (base == MAP_FAILED)
+		return {};
+	auto & header = * (const file_header *) base;
+	if (!check_file_header<T, C> (header, length)) {
+		munmap (base, length);
+		return {};
+	}
+	return {base, length, (const T *) ((const char *) base + header.data_offset), size_t (header.size)};
+}
+
+template <class T, size_t C>
+T sum_of (const mapped_ptr<T,C> & vec) {
+	static_assert (simd_arithmetic<T>::value, "sum_of takes arithmetic elements");
+	return simd_sum (vec.data(), vec.size());
+}
+
+template <class T, size_t C>
+T min_of (const mapped_ptr<T,C> & vec) {
+	static_assert (simd_arithmetic<T>::value, "min_of takes arithmetic elements");
+	assert (vec.size());
+	return simd_min (vec.data(), vec.size());
+}
+
+template <class T, size_t C>
+T max_of (const mapped_ptr<T,C> & vec) {
+	static_assert (simd_arithmetic<T>::value, "max_of takes arithmetic elements");
+	assert (vec.size());
+	return simd_max (vec.data(), vec.size());
+}
+
+template <class T, size_t C, class F>
+size_t find_of (const mapped_ptr<T,C> & vec, F && f) {
+	size_t len = vec.size();
+	for (size_t i=0; i<len; i++)
+		if (f (vec [i]))
+			return i;
+	return len;
+}
+
+template <class T, size_t C, cmp_op O>
+typename std::enable_if<simd_arithmetic<T>::value, size_t>::type
+find_of (const mapped_ptr<T,C> & vec, cmp<O,T> f) {
+	return simd_find (vec.data(), vec.size(), f);
+}
+
+template <class T, size_t C, class U, class F>
+U fold_of (const mapped_ptr<T,C> & vec, U && acc, F && f)
+{
+	for (const T & t : vec)
+		acc = f (std::move (acc), t);
+	return std::move (acc);
+}
+
+template <class T, size_t C, class F>
+auto map_of (const mapped_ptr<T,C> & vec, F && f)
+-> cached_ptr<typename std::result_of<F(T)>::type, C>
+{
+	cached_ptr<typename std::result_of<F(T)>::type, C> ret;
+	for (const T & t : vec)
+		ret.push_back (f (t));
+	return std::move (ret);
+}
+
+template <class T, size_t C>
+std::ostream & operator << (std::ostream & os, const mapped_ptr<T,C> & vec)
+	{ return write_text (os, vec.data(), vec.size(), vec.size()); }
+
+// parses numbers out of fd a node at a time. whitespace and delim
+// separate them; from_chars writes each one straight into the node.
+template <class T, size_t C>
+class text_reader {
+	static_assert (std::is_arithmetic<T>::value && C != growable, "text_reader fills fixed nodes of numbers");
+	static constexpr size_t block_size = 65536;
+	int fd;
+	char delim;
+	scratch_buffer<char, block_size> block;
+	char * cur;
+	char * end;
+	bool eof;
+	bool error;
+
+	bool separator (char c) const
+		{ return c == delim || c == ' ' || c == '\n' || c == '\t' || c == '\r'; }
+	// keeps the unparsed tail and reads more behind it; false at the end
+	// of the input, or when one token fills the whole block.
+	bool fill ()
+	{
+		size_t rest = end - cur;
+		memmove (block.data (), cur, rest);
+		cur = block.data ();
+		end = cur + rest;
+		if (eof || rest == block_size)
+			return false;
+		ssize_t got;
+		do
+			got = read (fd, end, block_size - rest);
+		while (got < 0 && errno == EINTR);
+		if (got <= 0) {
+			eof = true;
+			error = error || got < 0;
+			return false;
+		}
+		end += got;
+		return true;
+	}
+public:
+	text_reader (int fd, char delim = ',')
+	: fd (fd), delim (delim), block (block_size), cur (block.data ()), end (cur), eof (false), error (false)
+		{}
+	text_reader (const text_reader &) = delete;
+	// the next C numbers; fewer only at the end of the input or at a
+	// token that is not a T, after which failed () is true.
+	cached_ptr<T,C> next ()
+	{
+		cached_ptr<T,C> ret;
+		ret.reserve (C);
+		T * memory = ret.data();
+		size_t cnt = 0;
+		while (cnt < C && !error) {
+			while (cur != end && separator (*cur))
+				cur++;
+			if (cur == end) {
+				if (fill ())
+					continue;
+				break;
+			}
+			char * stop = cur;
+			while (stop != end && !separator (*stop))
+				stop++;
+			// the token may go on past what has been read so far
+			if (stop == end && !eof) {
+				if (!fill () && !eof)
+					error = true;
+				continue;
+			}
+			auto res = std::from_chars (cur, stop, memory [cnt]);
+			if (res.ec != std::errc () || res.ptr != stop) {
+				error = true;
+				break;
+			}
+			cnt++;
+			cur = stop;
+		}
+		ret.resize_uninitialized (cnt);
+		return std::move (ret);
+	}
+	bool failed () const
+		{ return error; }
+};
+
+// reads fixed size records of T from fd straight into the node.
+template <class T, size_t C>
+class record_reader {
+	static_assert (std::is_trivially_copyable<T>::value && C != growable, "record_reader fills fixed nodes of plain records");
+	int fd;
+	bool eof;
+	bool error;
+public:
+	record_reader (int fd)
+	: fd (fd), eof (false), error (false)
+		{}
+	// the next C records; fewer only at the end of the input, and a
+	// trailing partial record makes failed () true.
+	cached_ptr<T,C> next ()
+	{
+		cached_ptr<T,C> ret;
+		ret.reserve (C);
+		char * memory = (char *) ret.data();
+		size_t want = C * sizeof (T);
+		size_t got = 0;
+		while (got < want && !eof) {
+			ssize_t done = read (fd, memory + got, want - got);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0) {
+				eof = true;
+				error = error || done < 0;
+			} else
+				got += done;
+		}
+		if (got % sizeof (T))
+			error = true;
+		ret.resize_uninitialized (got / sizeof (T));
+		return std::move (ret);
+	}
+	bool failed () const
+		{ return error; }
+};
+
+// hands f every chunk the reader produces, one node alive at a time.
+template <class R, class F>
+void for_each_chunk (R & reader, F && f)
+{
+	for (;;) {
+		auto chunk = reader.next ();
+		if (!chunk.size())
+			break;
+		f (std::move (chunk));
+	}
+}
+
+} // namespace
+
+#endif
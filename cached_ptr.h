@@ -11,121 +11,698 @@
 #define cached_ptr_h
 
 #include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <initializer_list>
+#include <vector>
 
 namespace lm2 {
 
-template <size_t C>
+constexpr size_t cache_line_size = 64;
+
+template <size_t C, size_t A>
 class memory_chain;
 
-template <size_t C>
+// the header comes first, so with A == cache_line_size
+// the elements start on a cache line of their own.
+template <size_t C, size_t A = alignof (std::max_align_t)>
 struct memory_node {
-	char memory [C];
 	union {
-		memory_node <C> * next;
-		memory_chain <C> * chain;
+		memory_node <C, A> * next;
+		memory_chain <C, A> * chain;
 	};
+	alignas (A) char memory [C];
 	template <class T>
 	T & at (size_t pos)
 		{ return * (T *) (memory + sizeof (T) * pos); }
 };
 
+// default backend: every node is a separate heap allocation.
+struct heap_backend {
+	template <class N>
+	static N * allocate ()
+		{ return new N; }
+	template <class N, class F>
+	static void allocate_bulk (size_t len, F && f)
+	{
+		for (size_t i=0; i<len; i++)
+			f (new N);
+	}
+	template <class N>
+	static void deallocate (N * node)
+		{ delete node; }
+};
+
+struct memory_chain_defaults {
+	using backend = heap_backend;
+	static constexpr size_t max_nodes = size_t (-1);
+	static constexpr size_t max_bytes = size_t (64) << 20;
+	// pushes and pops between two decay passes. a size class the thread
+	// no longer uses decays only through decay_memory_caches ().
+	static constexpr unsigned decay_interval = 4096;
+};
+
+// specialize per size class (deriving from memory_chain_defaults)
+// to bound what each thread keeps cached or to change the backend.
 template <size_t C>
+struct memory_chain_traits : memory_chain_defaults {};
+
+// what the chains of one size class did, summed over threads.
+struct memory_chain_stats {
+	size_t cached_pops;	// served from a chain
+	size_t fresh_pops;	// went to the backend
+	size_t remote_frees;	// pushed from a thread other than the owner
+	size_t cached;	// nodes cached right now
+	size_t peak_cached;	// sum of each thread's peak
+	size_t bytes;	// held by the cached nodes
+	size_t peak_in_use;	// the most nodes one thread held at once
+
+	memory_chain_stats & operator += (const memory_chain_stats & stats)
+	{
+		cached_pops += stats.cached_pops;
+		fresh_pops += stats.fresh_pops;
+		remote_frees += stats.remote_frees;
+		cached += stats.cached;
+		peak_cached += stats.peak_cached;
+		bytes += stats.bytes;
+		if (peak_in_use < stats.peak_in_use)
+			peak_in_use = stats.peak_in_use;
+		return *this;
+	}
+};
+
+struct memory_class_stats {
+	size_t size;
+	size_t align;
+	memory_chain_stats stats;
+};
+
+// every size class the program instantiates, registered before main.
+class memory_class_registry {
+	struct memory_class {
+		size_t size;
+		size_t align;
+		memory_chain_stats (* snapshot) ();
+		void (* make_cache) (unsigned len);
+		void (* trim) (size_t keep);
+		void (* decay) ();
+	};
+	std::mutex mutex;
+	std::vector<memory_class> classes;
+public:
+	static memory_class_registry & instance ()
+	{
+		static memory_class_registry registry;
+		return registry;
+	}
+	bool enter (const memory_class & c)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		classes.push_back (c);
+		return true;
+	}
+	std::vector<memory_class_stats> snapshot ()
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		std::vector<memory_class_stats> ret;
+		for (auto & c : classes)
+			ret.push_back ({c.size, c.align, c.snapshot ()});
+		return ret;
+	}
+	// false when no such size class is compiled in.
+	bool make_cache (size_t size, size_t align, unsigned len)
+	{
+		void (* make_cache) (unsigned) = nullptr;
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			for (auto & c : classes)
+				if (c.size == size && c.align == align)
+					make_cache = c.make_cache;
+		}
+		if (make_cache)
+			make_cache (len);
+		return make_cache;
+	}
+	void trim ()
+	{
+		std::vector<void (*) (size_t)> trims;
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			for (auto & c : classes)
+				trims.push_back (c.trim);
+		}
+		for (auto trim : trims)
+			trim (0);
+	}
+	void decay ()
+	{
+		std::vector<void (*) ()> decays;
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			for (auto & c : classes)
+				decays.push_back (c.decay);
+		}
+		for (auto decay : decays)
+			decay ();
+	}
+};
+
+// the live chains of one size class, and what the dead ones left behind.
+template <size_t C, size_t A>
+class memory_chain_registry {
+	std::mutex mutex;
+	std::vector<const memory_chain<C, A> *> chains;
+	memory_chain_stats retired;
+
+	memory_chain_registry ()
+	: retired ()
+		{}
+public:
+	static memory_chain_registry & instance ()
+	{
+		static memory_chain_registry registry;
+		return registry;
+	}
+	void enter (const memory_chain<C, A> * chain)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		chains.push_back (chain);
+	}
+	void leave (const memory_chain<C, A> * chain)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		retired += chain->stats ();
+		for (auto & live : chains)
+			if (live == chain) {
+				live = chains.back ();
+				chains.pop_back ();
+				break;
+			}
+	}
+	memory_chain_stats snapshot ()
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		memory_chain_stats ret = retired;
+		for (auto chain : chains)
+			ret += chain->stats ();
+		return ret;
+	}
+};
+
+template <size_t C, size_t A = alignof (std::max_align_t)>
 class memory_chain {
-	memory_node <C> * chain;
-	memory_node <C> * reserved;
+	using traits = memory_chain_traits<C>;
+	using backend = typename traits::backend;
+	memory_node <C, A> * chain;
+	std::atomic <memory_node <C, A> *> reserved;
 	std::thread::id thread_id;
-	std::mutex mutex;
+	size_t cached;
+	size_t low_water;
+	// nodes make_cache put in on purpose; decay leaves them alone.
+	size_t warm;
+	unsigned ticks;
+	// nodes taken back off the remote-free stack
+	size_t unreserved;
+	// set once the owning thread has exited; read by the owner only.
+	bool abandoned;
+	// nodes still out after the owner exited, less those since freed;
+	// the free that brings it to 0 deletes the chain.
+	std::atomic<long> orphans;
+
+	// written by the owner only, except remote_frees, and read by
+	// snapshots from any thread.
+	std::atomic<size_t> cached_pops;
+	std::atomic<size_t> fresh_pops;
+	std::atomic<size_t> remote_frees;
+	std::atomic<size_t> cached_now;
+	std::atomic<size_t> peak_cached;
+	std::atomic<size_t> pushes;
+	std::atomic<size_t> peak_in_use;
+
+	// instantiated along with the chain, so that a profile can name
+	// any size class before its first chain exists.
+	static const bool registered;
 public:
 	memory_chain ()
 	: chain (nullptr), reserved (nullptr),
-	thread_id (std::this_thread::get_id())
-		{}
+	thread_id (std::this_thread::get_id()),
+	cached (0), low_water (0), warm (0), ticks (0), unreserved (0), abandoned (false), orphans (0),
+	cached_pops (0), fresh_pops (0), remote_frees (0), cached_now (0), peak_cached (0),
+	pushes (0), peak_in_use (0)
+	{
+		(void) &registered;
+		memory_chain_registry<C, A>::instance ().enter (this);
+	}
+	memory_chain (const memory_chain &) = delete;
 	~memory_chain ()
 	{
-		unsigned cnt = 0;
-		while (chain) {
-			auto node = chain;
-			chain = chain->next;
-			delete node;
-			cnt++;
-		}
-		while (reserved) {
-			auto node = reserved;
-			reserved = reserved->next;
-			delete node;
-			cnt++;
+		if (!abandoned)
+			close ();
+	}
+	// called as the owning thread exits. nodes still in use elsewhere keep
+	// the chain alive, and go straight back to the backend when freed.
+	void abandon ()
+	{
+		close ();
+		auto node = reserved.exchange (closed (), std::memory_order_acquire);
+		for (; node; unreserved++) {
+			auto next = node->next;
+			backend::deallocate (node);
+			node = next;
 		}
-#ifdef DEBUG
-		std::cout << "lm2::make_memory_cache<" << C << ">(" << cnt << ");" << std::endl;
-#endif
+		abandoned = true;
+		long out = cached_pops.load (std::memory_order_relaxed) +
+			fresh_pops.load (std::memory_order_relaxed) -
+			pushes.load (std::memory_order_relaxed) - unreserved;
+		if (orphans.fetch_add (out) == -out)
+			delete this;
 	}
-	void reserve (memory_node<C> * node) {
-		std::lock_guard<std::mutex> lock (mutex);
-		node->next = reserved;
-		reserved = node;
+	memory_chain_stats stats () const
+	{
+		size_t now = cached_now.load (std::memory_order_relaxed);
+		return {cached_pops.load (std::memory_order_relaxed),
+			fresh_pops.load (std::memory_order_relaxed),
+			remote_frees.load (std::memory_order_relaxed),
+			now, peak_cached.load (std::memory_order_relaxed),
+			now * sizeof (memory_node<C, A>),
+			peak_in_use.load (std::memory_order_relaxed)};
+	}
+	static constexpr size_t limit ()
+	{
+		return traits::max_bytes / sizeof (memory_node<C, A>) < traits::max_nodes ?
+			traits::max_bytes / sizeof (memory_node<C, A>) : traits::max_nodes;
+	}
+	size_t size () const
+		{ return cached; }
+	// nodes freed on other threads go onto a lock-free stack;
+	// only the owner ever takes them off, so there is no ABA on pop.
+	void reserve (memory_node<C, A> * node) {
+		remote_frees.fetch_add (1, std::memory_order_relaxed);
+		node->next = reserved.load (std::memory_order_relaxed);
+		do
+			if (node->next == closed ()) {
+				backend::deallocate (node);
+				if (orphans.fetch_sub (1) == 1)
+					delete this;
+				return;
+			}
+		while (!reserved.compare_exchange_weak (node->next, node,
+				std::memory_order_release, std::memory_order_relaxed));
 	}
-	void push (memory_node<C> * node)
+	void push (memory_node<C, A> * node)
 	{
-		if (thread_id != std::this_thread::get_id()) {
+		if (thread_id != std::this_thread::get_id() || abandoned) {
 			reserve (node);
 			return;
 		}
-		node->next = chain;
-		chain = node;
+		bump (pushes);
+		if (cached >= limit ())
+			backend::deallocate (node);
+		else {
+			node->next = chain;
+			chain = node;
+			cached++;
+			publish ();
+		}
+		tick ();
 	}
 	void unreserve ()
 	{
-		std::lock_guard<std::mutex> lock (mutex);
-		while (reserved) {
-			auto node = reserved;
-			reserved = node->next;
+		auto node = reserved.exchange (nullptr, std::memory_order_acquire);
+		while (node) {
+			auto next = node->next;
 			node->next = chain;
 			chain = node;
+			cached++;
+			unreserved++;
+			node = next;
 		}
+		publish ();
+		if (cached > limit ())
+			trim (limit ());
 	}
-	memory_node<C> * pop ()
+	memory_node<C, A> * pop ()
 	{
-		if (reserved)
+		// the shared line is only touched once the local chain runs dry.
+		if (!chain && reserved.load (std::memory_order_relaxed))
 			unreserve();
 		auto ret = chain;
-		if (ret)
+		if (ret) {
 			chain = ret->next;
-		else
-			ret = new memory_node<C>;
+			if (--cached < low_water)
+				low_water = cached;
+			bump (cached_pops);
+			publish ();
+		}
+		else {
+			ret = backend::template allocate<memory_node<C, A>> ();
+			bump (fresh_pops);
+		}
+		size_t in_use = cached_pops.load (std::memory_order_relaxed) +
+			fresh_pops.load (std::memory_order_relaxed) -
+			pushes.load (std::memory_order_relaxed) -
+			remote_frees.load (std::memory_order_relaxed);
+		if (in_use > peak_in_use.load (std::memory_order_relaxed))
+			peak_in_use.store (in_use, std::memory_order_relaxed);
 		ret->chain = this;
+		tick ();
 		return ret;
 	}
 	void make_cache (unsigned len)
 	{
-		for (unsigned i=0; i<len; i++) {
-			auto node = new memory_node<C>;
-			node->next = chain;
-			chain = node;
+		if (cached + len > limit ())
+			len = cached < limit () ? limit () - cached : 0;
+		backend::template allocate_bulk<memory_node<C, A>> (len,
+			[this] (memory_node<C, A> * node) {
+				node->next = chain;
+				chain = node;
+				cached++;
+			});
+		warm += len;
+		low_water = cached;
+		publish ();
+	}
+	// frees cached nodes until at most `keep` remain.
+	void trim (size_t keep = 0)
+	{
+		while (cached > keep) {
+			auto node = chain;
+			chain = node->next;
+			backend::deallocate (node);
+			cached--;
 		}
+		if (low_water > cached)
+			low_water = cached;
+		if (warm > keep)
+			warm = keep;
+		publish ();
+	}
+private:
+	void close ()
+	{
+		unreserve ();
+#ifdef DEBUG
+		std::cout << "lm2::make_memory_cache<" << C << ">(" << cached << ");" << std::endl;
+#endif
+		trim ();
+		memory_chain_registry<C, A>::instance ().leave (this);
+	}
+	// marks the remote-free stack of an abandoned chain; never a node.
+	memory_node<C, A> * closed ()
+		{ return (memory_node<C, A> *) this; }
+	// the owner is the only writer, so no read-modify-write is needed.
+	static void bump (std::atomic<size_t> & counter)
+		{ counter.store (counter.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+	void publish ()
+	{
+		cached_now.store (cached, std::memory_order_relaxed);
+		if (cached > peak_cached.load (std::memory_order_relaxed))
+			peak_cached.store (cached, std::memory_order_relaxed);
+	}
+	void tick ()
+	{
+		if (++ticks < traits::decay_interval)
+			return;
+		decay ();
+	}
+public:
+	// nodes that sat idle since the last pass are surplus over the
+	// high-water mark of that time; returns half of them, down to the
+	// warm ones.
+	void decay ()
+	{
+		ticks = 0;
+		if (low_water > warm)
+			trim (cached - (low_water - warm) / 2);
+		low_water = cached;
 	}
 };
 
-template <size_t C>
-memory_chain<C> & get_memory_chain ()
+// the chain of the calling thread. it lives on the heap, so that nodes
+// freed after the thread exited still find it.
+template <size_t C, size_t A = alignof (std::max_align_t)>
+memory_chain<C, A> & get_memory_chain ()
 {
-	thread_local memory_chain<C> chain;
-	return chain;
+	struct owner {
+		memory_chain<C, A> * chain = new memory_chain<C, A>;
+		~owner ()
+			{ chain->abandon (); }
+	};
+	thread_local owner self;
+	return * self.chain;
 }
 
-template <size_t S>
+template <size_t S, size_t A = alignof (std::max_align_t)>
 void make_memory_cache (unsigned len)
 {
-	memory_chain<S> & chain = get_memory_chain<S>();
+	memory_chain<S, A> & chain = get_memory_chain<S, A>();
 	chain.make_cache (len);
 }
 
+template <size_t S, size_t A = alignof (std::max_align_t)>
+void trim_memory_cache (size_t keep = 0)
+{
+	memory_chain<S, A> & chain = get_memory_chain<S, A>();
+	chain.unreserve ();
+	chain.trim (keep);
+}
+
+template <size_t S, size_t A = alignof (std::max_align_t)>
+void decay_memory_cache ()
+	{ get_memory_chain<S, A>().decay (); }
+
+// counters of the size class S, summed over live and exited threads.
+template <size_t S, size_t A = alignof (std::max_align_t)>
+memory_chain_stats snapshot_memory_cache ()
+	{ return memory_chain_registry<S, A>::instance ().snapshot (); }
+
+// the same for every size class the program instantiates.
+inline std::vector<memory_class_stats> snapshot_memory_caches ()
+	{ return memory_class_registry::instance ().snapshot (); }
+
+template <size_t C, size_t A>
+const bool memory_chain<C, A>::registered = memory_class_registry::instance ().enter ({
+	C, A, &snapshot_memory_cache<C, A>, &make_memory_cache<C, A>, &trim_memory_cache<C, A>,
+	&decay_memory_cache<C, A>});
+
+// frees every node the calling thread has cached, in every size class.
+inline void trim_memory_caches ()
+	{ memory_class_registry::instance ().trim (); }
+
+// one decay pass over every size class of the calling thread, for
+// threads that go idle or stop using a class; call it periodically.
+inline void decay_memory_caches ()
+	{ memory_class_registry::instance ().decay (); }
+
+// writes one "size align nodes" line per size class, nodes being the
+// most any one thread held at once so far.
+inline bool save_memory_profile (const char * path)
+{
+	FILE * file = fopen (path, "w");
+	if (!file)
+		return false;
+	for (auto & c : snapshot_memory_caches ())
+		if (c.stats.peak_in_use)
+			fprintf (file, "%zu %zu %zu\n", c.size, c.align, c.stats.peak_in_use);
+	return fclose (file) == 0;
+}
+
+// pre-warms the calling thread's chains from a saved profile;
+// size classes this build no longer has are skipped.
+inline bool load_memory_profile (const char * path)
+{
+	FILE * file = fopen (path, "r");
+	if (!file)
+		return false;
+	size_t size, align, nodes;
+	while (fscanf (file, "%zu %zu %zu", &size, &align, &nodes) == 3)
+		memory_class_registry::instance ().make_cache (size, align, unsigned (nodes));
+	fclose (file);
+	return true;
+}
+
+// specialize to std::true_type to give T's elements their own cache line.
+template <class T>
+struct cache_line_aligned : std::false_type {};
+
+template <class T>
+struct node_alignment : std::integral_constant<size_t,
+	cache_line_aligned<T>::value && alignof (T) < cache_line_size ? cache_line_size :
+	alignof (T) < alignof (std::max_align_t) ? alignof (std::max_align_t) :
+	alignof (T)> {};
+
+// objects that can move to a new address as plain bytes, leaving nothing
+// to destroy behind; specialize it for types such as a lone unique_ptr.
+template <class T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// moves len objects from src into raw memory at dst and ends them at src;
+// dst may overlap src from below.
+template <class T>
+void relocate (T * dst, T * src, size_t len)
+{
+	if (!len)
+		return;
+	if (is_trivially_relocatable<T>::value)
+		memmove ((void *) dst, (const void *) src, len * sizeof (T));
+	else
+		for (size_t i=0; i<len; i++) {
+			new (dst + i) T (std::move (src [i]));
+			src [i].~T();
+		}
+}
+
+// std allocator over the memory_chain of sizeof (T); single objects come
+// from the pool, arrays from the heap.
+template <class T>
+struct pool_allocator {
+	using value_type = T;
+	using node_type = memory_node<sizeof (T), node_alignment<T>::value>;
+
+	pool_allocator ()
+		{}
+	template <class U>
+	pool_allocator (const pool_allocator<U> &)
+		{}
+	T * allocate (size_t n)
+	{
+		if (n != 1)
+			return std::allocator<T>().allocate (n);
+		return (T *) get_memory_chain<sizeof (T), node_alignment<T>::value>().pop()->memory;
+	}
+	void deallocate (T * p, size_t n)
+	{
+		if (n != 1) {
+			std::allocator<T>().deallocate (p, n);
+			return;
+		}
+		auto node = (node_type *) ((char *) p - offsetof (node_type, memory));
+		node->chain->push (node);
+	}
+	template <class U>
+	bool operator == (const pool_allocator<U> &) const
+		{ return true; }
+	template <class U>
+	bool operator != (const pool_allocator<U> &) const
+		{ return false; }
+};
+
+// specialize to keep T[C] inside the cached_ptr object (true)
+// or in a pooled memory_node (false). by default anything of two
+// words or less is kept inline.
+template <class T, size_t C>
+struct inline_storage : std::integral_constant<bool,
+	sizeof (T) * C <= 2 * sizeof (void *) &&
+	std::is_nothrow_move_constructible<T>::value> {};
+
+template <class T, size_t C, bool I = inline_storage<T,C>::value>
+class cached_storage {
+	static constexpr size_t node_align = node_alignment<T>::value;
+	memory_node<sizeof (T) * C, node_align> * node;
+	// elements start this far into the node; dropped ones leave it behind.
+	size_t offset;
+public:
+	cached_storage ()
+	: node (get_memory_chain<sizeof (T) * C, node_align>().pop()), offset (0)
+		{}
+	cached_storage (cached_storage & self, size_t)
+	: node (self.node), offset (self.offset)
+	{
+		self.node = nullptr;
+		self.offset = 0;
+	}
+	~cached_storage ()
+		{ release (); }
+	bool valid () const
+		{ return node; }
+	T * data () const
+		{ return (T *) node->memory; }
+	size_t front () const
+		{ return offset; }
+	void front (size_t pos)
+		{ offset = pos; }
+	void release ()
+	{
+		if (node)
+			node->chain->push (node);
+		node = nullptr;
+	}
+	// takes over the elements of self, leaving it empty.
+	void steal (cached_storage & self, size_t)
+	{
+		release ();
+		node = self.node;
+		offset = self.offset;
+		self.node = nullptr;
+		self.offset = 0;
+	}
+};
+
+// a few words at most, so dropped elements are moved out of the way
+// and the first one always sits at the start.
+template <class T, size_t C>
+class cached_storage<T, C, true> {
+	alignas (T) char memory [sizeof (T) * C];
+public:
+	cached_storage ()
+		{}
+	cached_storage (cached_storage & self, size_t len)
+		{ steal (self, len); }
+	bool valid () const
+		{ return true; }
+	T * data () const
+		{ return (T *) memory; }
+	static constexpr size_t front ()
+		{ return 0; }
+	void front (size_t)
+		{}
+	void release ()
+		{}
+	void steal (cached_storage & self, size_t len)
+		{ relocate (data(), self.data(), len); }
+};
+
+// elements in a pooled node keep their address when the cached_ptr is
+// moved. inline ones (see inline_storage, e.g. cached_ptr<int,4>) are
+// moved along with it, so pointers from data () or refdup do not
+// survive a move; specialize inline_storage to false where they must.
 template <class T, size_t C=1>
 class cached_ptr {
-	memory_node<sizeof (T) * C> * node;
+	cached_storage<T,C> storage;
 	size_t len;
-	
+
+	T * first () const
+		{ return storage.data() + storage.front(); }
+	void destroy ()
+	{
+		if (!std::is_trivially_destructible<T>::value && storage.valid ())
+			for (size_t i=0; i<len; i++)
+				first() [i].~T();
+	}
+	// makes room at the back by moving the elements down to the start.
+	void compact (size_t size)
+	{
+		assert (size <= C);
+		if (storage.front() + size <= C)
+			return;
+		relocate (storage.data(), first(), len);
+		storage.front (0);
+	}
+	// an empty vector starts over at the start of its node.
+	void set_size (size_t size)
+	{
+		len = size;
+		if (!len)
+			storage.front (0);
+	}
 public:
 	//間接参照演算子と前置インクリメント演算子と不等価演算子を定義する
 	class iterator
@@ -166,94 +743,409 @@ public:
 public:
 	template <class F>
 	cached_ptr (size_t size, T && ini, F f)
-	: node (get_memory_chain<sizeof(T)*C>().pop()), len (size)
+	: len (size)
 	{
 		assert (size <= C);
-		node->template at <T> (0) = ini;
-		for (int i=1; i<size; i++)
-			new (node->memory + sizeof (T) * (i)) T (f (node [i - 1]));
+		T * memory = storage.data();
+		new (memory) T (std::move (ini));
+		for (size_t i=1; i<size; i++)
+			new (memory + i) T (f (memory [i - 1]));
 	}
 	template <class F>
 	cached_ptr (size_t size, F f)
-	: node (get_memory_chain<sizeof(T)*C>().pop()), len (size)
+	: len (size)
 	{
 		assert (size <= C);
-		for (int i=0; i<size; i++)
-			new (node->memory + sizeof (T) * i) T (f (i));
+		for (size_t i=0; i<size; i++)
+			new (storage.data() + i) T (f (i));
 	}
 	cached_ptr ()
-	: node (get_memory_chain<sizeof(T)*C>().pop()), len (0)
+	: len (0)
 	{
 	}
 	template <class I>
 	cached_ptr (I && ini)
-	: node (get_memory_chain<sizeof(T)*C>().pop()), len (1)
+	: len (1)
 	{
-		new (node->memory) T (ini);
+		new (storage.data()) T (ini);
 	}
 	template <class I>
 	cached_ptr (std::initializer_list<I> inits)
-	: node (get_memory_chain<sizeof(T)*C>().pop()), len (inits.size())
+	: len (inits.size())
 	{
 		assert (C >= len);
 		size_t pos = 0;
 		for (const I & ini : inits)
-			new (node->memory + sizeof (T) * (pos++)) T (ini);
+			new (storage.data() + pos++) T (ini);
 	}
 	~cached_ptr ()
 	{
-		if (node) {
-			for (size_t i=0; i<len; i++)
-				node->template at <T> (i).~T();
-			node->chain->push (node);
-		}
+		destroy ();
 	}
     cached_ptr (cached_ptr && self) noexcept
-	: node (std::move (self.node)), len (std::move (self.len))
+	: storage (self.storage, self.len), len (self.len)
 	{
-		self.node = nullptr;
+		self.len = 0;
 	};
     cached_ptr & operator = (cached_ptr && self)
 	{
-		if (node) {
+		destroy ();
+		len = self.len;
+		storage.steal (self.storage, len);
+		self.len = 0;
+		return *this;
+	}
+	size_t size () const
+		{ return len; }
+	T * data () const
+		{ return first(); }
+	// data () may move to make room for size elements.
+	void reserve (size_t size)
+		{ compact (size); }
+	// sets the length without constructing or destroying anything;
+	// the caller has already done that for the elements in between.
+	void resize_uninitialized (size_t size)
+		{ compact (size); set_size (size); }
+	// ends the first n elements. a node keeps the rest where they are;
+	// inline storage, a few words at most, moves them down.
+	void drop_front (size_t n)
+	{
+		assert (n <= len);
+		T * memory = first();
+		for (size_t i=0; i<n; i++)
+			memory [i].~T();
+		if (inline_storage<T,C>::value)
+			relocate (memory, memory + n, len - n);
+		else
+			storage.front (storage.front() + n);
+		set_size (len - n);
+	}
+	void resize (size_t size)
+	{
+		compact (size);
+		T * memory = first();
+		if (size == len)
+			return;
+		else if (size > len)
+			for (size_t i=len; i<size; i++)
+				new (memory + i) T();
+		else
+			for (size_t i=len; i>size; i--)
+				memory [i - 1].~T();
+		set_size (size);
+	}
+	void push_back (T && t)
+	{
+		compact (len + 1);
+		new (first() + len) T (std::move (t));
+		len++;
+	}
+	T & operator [] (unsigned pos) const
+		{ assert (pos < len); return first() [pos]; }
+	T & operator * () const
+		{ return first() [0]; }
+	T * operator -> () const
+		{ return first(); }
+	T * operator & () const
+		{ return first(); }
+};
+
+// capacity tag: cached_ptr<T, growable> starts in a small size class and
+// moves into the next, twice as large, class whenever it fills up.
+constexpr size_t growable = 0;
+
+template <class T>
+using growable_ptr = cached_ptr<T, growable>;
+
+// the geometric size classes T[first << level], picked at run time.
+template <class T>
+class size_classes {
+	static constexpr size_t align = node_alignment<T>::value;
+	template <size_t L>
+	using node_type = memory_node<sizeof (T) * (size_t (8) << L), align>;
+
+	template <size_t L>
+	static void * pop_level ()
+		{ return get_memory_chain<sizeof (T) * (size_t (8) << L), align>().pop(); }
+	template <size_t L>
+	static void push_level (void * node)
+		{ ((node_type<L> *) node)->chain->push ((node_type<L> *) node); }
+	template <size_t... L>
+	static void * pop (unsigned level, std::index_sequence<L...>)
+	{
+		static void * (* const pops []) () = { &pop_level<L>... };
+		return pops [level] ();
+	}
+	template <size_t... L>
+	static void push (void * node, unsigned level, std::index_sequence<L...>)
+	{
+		static void (* const pushes []) (void *) = { &push_level<L>... };
+		pushes [level] (node);
+	}
+public:
+	static constexpr size_t first = 8;
+	static constexpr unsigned levels = 20;
+
+	static constexpr size_t capacity (unsigned level)
+		{ return first << level; }
+	static unsigned level_of (size_t size)
+	{
+		if (size > capacity (levels - 1))
+			throw std::length_error ("lm2::growable_ptr: past the largest size class");
+		unsigned level = 0;
+		while (capacity (level) < size)
+			level++;
+		return level;
+	}
+	static void * pop (unsigned level)
+		{ return pop (level, std::make_index_sequence<levels> ()); }
+	static void push (void * node, unsigned level)
+		{ push (node, level, std::make_index_sequence<levels> ()); }
+	// the header is the same for every level, so is the offset of memory.
+	static T * data (void * node)
+		{ return (T *) ((node_type<0> *) node)->memory; }
+};
+
+template <class T>
+class cached_ptr<T, growable> {
+	using classes = size_classes<T>;
+	void * node;
+	// the first element; dropped ones are left behind it in the node.
+	T * memory;
+	size_t len;
+	unsigned level;
+
+	void acquire (unsigned to)
+	{
+		node = classes::pop (to);
+		memory = classes::data (node);
+		level = to;
+	}
+	void release ()
+	{
+		if (!std::is_trivially_destructible<T>::value)
 			for (size_t i=0; i<len; i++)
-				node->template at <T> (i).~T();
-			node->chain->push (node);
+				memory [i].~T();
+		classes::push (node, level);
+	}
+	void grow (size_t size)
+	{
+		void * old_node = node;
+		T * old_memory = memory;
+		unsigned old_level = level;
+		acquire (classes::level_of (size));
+		relocate (memory, old_memory, len);
+		classes::push (old_node, old_level);
+	}
+	T * base () const
+		{ return classes::data (node); }
+	// an empty vector starts over at the start of its node.
+	void set_size (size_t size)
+	{
+		len = size;
+		if (!len)
+			memory = base ();
+	}
+public:
+	class iterator
+	{
+	public:
+		iterator (const cached_ptr<T,growable> & self, unsigned pos)
+		: self (self), pos (pos)
+		{
 		}
-		node = std::move(self.node);
-		len = std::move(self.len);
+
+		T & operator * ()
+		{
+			return self [pos];
+		}
+
+		void operator ++ ()
+		{
+			pos++;
+		}
+
+		bool operator != (iterator & iter)
+		{
+			return pos != iter.pos;
+		}
+
+	private:
+		const cached_ptr & self;
+		unsigned pos;
+	};
+    iterator begin() const
+    {
+        return iterator (*this, 0);
+    }
+    iterator end() const
+    {
+        return iterator (*this, len);
+    }
+public:
+	template <class F>
+	cached_ptr (size_t size, T && ini, F f)
+	: len (size)
+	{
+		acquire (classes::level_of (size));
+		new (memory) T (std::move (ini));
+		for (size_t i=1; i<size; i++)
+			new (memory + i) T (f (memory [i - 1]));
+	}
+	template <class F>
+	cached_ptr (size_t size, F f)
+	: len (size)
+	{
+		acquire (classes::level_of (size));
+		for (size_t i=0; i<size; i++)
+			new (memory + i) T (f (i));
+	}
+	cached_ptr ()
+	: len (0)
+	{
+		acquire (0);
+	}
+	template <class I>
+	cached_ptr (I && ini)
+	: len (1)
+	{
+		acquire (0);
+		new (memory) T (ini);
+	}
+	template <class I>
+	cached_ptr (std::initializer_list<I> inits)
+	: len (inits.size())
+	{
+		acquire (classes::level_of (len));
+		size_t pos = 0;
+		for (const I & ini : inits)
+			new (memory + pos++) T (ini);
+	}
+	~cached_ptr ()
+	{
+		if (node)
+			release ();
+	}
+	cached_ptr (cached_ptr && self) noexcept
+	: node (self.node), memory (self.memory), len (self.len), level (self.level)
+	{
+		self.node = nullptr;
+		self.len = 0;
+	}
+	cached_ptr & operator = (cached_ptr && self)
+	{
+		if (node)
+			release ();
+		node = self.node;
+		memory = self.memory;
+		len = self.len;
+		level = self.level;
 		self.node = nullptr;
+		self.len = 0;
 		return *this;
 	}
 	size_t size () const
 		{ return len; }
+	size_t capacity () const
+		{ return classes::capacity (level); }
+	static constexpr size_t max_size ()
+		{ return classes::capacity (classes::levels - 1); }
+	T * data () const
+		{ return memory; }
+	// data () may move to make room for size elements: down to the start
+	// of the node if they fit there, into a larger node otherwise.
+	// past max_size () it throws std::length_error and leaves them alone.
+	void reserve (size_t size)
+	{
+		if (size > capacity ())
+			grow (size);
+		else if (memory + size > base () + capacity ()) {
+			relocate (base (), memory, len);
+			memory = base ();
+		}
+	}
+	void resize_uninitialized (size_t size)
+		{ reserve (size); set_size (size); }
+	void drop_front (size_t n)
+	{
+		assert (n <= len);
+		for (size_t i=0; i<n; i++)
+			memory [i].~T();
+		memory += n;
+		set_size (len - n);
+	}
 	void resize (size_t size)
 	{
-		assert (size <= C);
+		reserve (size);
 		if (size == len)
 			return;
 		else if (size > len)
 			for (size_t i=len; i<size; i++)
-				new (node->memory + sizeof (T) * i) T();
+				new (memory + i) T();
 		else
 			for (size_t i=len; i>size; i--)
-				node->template at <T> (i - 1).~T();
-		len = size;
+				memory [i - 1].~T();
+		set_size (size);
 	}
 	void push_back (T && t)
 	{
-		assert (len + 1 <= C);
-		new (node->memory + sizeof (T) * len) T (std::move (t));
+		if (memory + len == base () + capacity ())
+			reserve (len + 1);
+		new (memory + len) T (std::move (t));
 		len++;
 	}
 	T & operator [] (unsigned pos) const
-		{ assert (pos < len); return node->template at <T> (pos); }
+		{ assert (pos < len); return memory [pos]; }
 	T & operator * () const
-		{ return node->template at <T> (0); }
+		{ return memory [0]; }
 	T * operator -> () const
-		{ return & node->template at <T> (0); }
+		{ return memory; }
 	T * operator & () const
-		{ return & node->template at <T> (0); }
+		{ return memory; }
+};
+
+// appends len elements relocated from src, which the caller then forgets.
+template <class T, size_t C>
+void relocate_back (cached_ptr<T,C> & vec, T * src, size_t len)
+{
+	size_t size = vec.size();
+	vec.reserve (size + len);
+	relocate (vec.data() + size, src, len);
+	vec.resize_uninitialized (size + len);
+}
+
+// raw room for up to `len` elements of a cached_ptr<T,C>, taken from
+// the same size class; nothing in it is constructed or destroyed.
+template <class T, size_t C>
+class scratch_buffer {
+	memory_node<sizeof (T) * C, node_alignment<T>::value> * node;
+public:
+	scratch_buffer (size_t len)
+	: node (get_memory_chain<sizeof (T) * C, node_alignment<T>::value>().pop())
+	{
+		assert (len <= C);
+		(void) len;
+	}
+	scratch_buffer (const scratch_buffer &) = delete;
+	~scratch_buffer ()
+		{ node->chain->push (node); }
+	T * data () const
+		{ return (T *) node->memory; }
+};
+
+template <class T>
+class scratch_buffer<T, growable> {
+	unsigned level;
+	void * node;
+public:
+	scratch_buffer (size_t len)
+	: level (size_classes<T>::level_of (len)), node (size_classes<T>::pop (level))
+		{}
+	scratch_buffer (const scratch_buffer &) = delete;
+	~scratch_buffer ()
+		{ size_classes<T>::push (node, level); }
+	T * data () const
+		{ return size_classes<T>::data (node); }
 };
 
 } // namespace
@@ -0,0 +1,215 @@
+//
+//  cached_ring.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef cached_ring_h
+#define cached_ring_h
+
+#include <atomic>
+
+#include "cached_ptr.h"
+
+namespace lm2 {
+
+// FIFO of up to C elements in the same pooled node a cached_ptr<T,C>
+// would use; the elements wrap around the end of the node.
+template <class T, size_t C>
+class cached_ring {
+	using node_type = memory_node<sizeof (T) * C, node_alignment<T>::value>;
+	node_type * node;
+	size_t head;
+	size_t len;
+
+	T * slot (size_t pos) const
+	{
+		size_t i = head + pos;
+		return (T *) node->memory + (i < C ? i : i - C);
+	}
+	// the first n elements lie in at most two runs: the one up to the end
+	// of the node, and the one from its start.
+	size_t first_run (size_t n) const
+		{ return n < C - head ? n : C - head; }
+public:
+	cached_ring ()
+	: node (get_memory_chain<sizeof (T) * C, node_alignment<T>::value>().pop()), head (0), len (0)
+		{}
+	cached_ring (cached_ring && self) noexcept
+	: node (self.node), head (self.head), len (self.len)
+	{
+		self.node = nullptr;
+		self.len = 0;
+	}
+	cached_ring & operator = (cached_ring && self)
+	{
+		release ();
+		node = self.node;
+		head = self.head;
+		len = self.len;
+		self.node = nullptr;
+		self.len = 0;
+		return *this;
+	}
+	~cached_ring ()
+		{ release (); }
+	size_t size () const
+		{ return len; }
+	static constexpr size_t capacity ()
+		{ return C; }
+	bool empty () const
+		{ return !len; }
+	bool full () const
+		{ return len == C; }
+	T & operator [] (size_t pos) const
+		{ assert (pos < len); return * slot (pos); }
+	T & front () const
+		{ return (* this) [0]; }
+	T & back () const
+		{ return (* this) [len - 1]; }
+	void push_back (T && t)
+	{
+		assert (len < C);
+		new (slot (len)) T (std::move (t));
+		len++;
+	}
+	T pop_front ()
+	{
+		assert (len);
+		T * p = slot (0);
+		T ret (std::move (* p));
+		p->~T();
+		drop_destroyed (1);
+		return std::move (ret);
+	}
+	// ends the first n elements.
+	void drop (size_t n)
+	{
+		assert (n <= len);
+		if (!std::is_trivially_destructible<T>::value)
+			for (size_t i=0; i<n; i++)
+				slot (i)->~T();
+		drop_destroyed (n);
+	}
+	// moves the first n elements out, in order, a run at a time.
+	template <size_t C2 = C>
+	cached_ptr<T,C2> take (size_t n)
+	{
+		assert (n <= len);
+		cached_ptr<T,C2> ret;
+		size_t run = first_run (n);
+		relocate_back (ret, slot (0), run);
+		relocate_back (ret, (T *) node->memory, n - run);
+		drop_destroyed (n);
+		return std::move (ret);
+	}
+	// moves every element of vec in at the back.
+	template <size_t C2>
+	void append (cached_ptr<T,C2> && vec)
+	{
+		size_t n = vec.size();
+		assert (len + n <= C);
+		size_t end = head + len < C ? head + len : head + len - C;
+		size_t run = n < C - end ? n : C - end;
+		relocate ((T *) node->memory + end, vec.data(), run);
+		relocate ((T *) node->memory, vec.data() + run, n - run);
+		vec.resize_uninitialized (0);
+		len += n;
+	}
+private:
+	void release ()
+	{
+		if (!node)
+			return;
+		drop (len);
+		node->chain->push (node);
+		node = nullptr;
+	}
+	void drop_destroyed (size_t n)
+	{
+		len -= n;
+		head = len ? (head + n) % C : 0;
+	}
+};
+
+// lock-free single producer, single consumer ring. head is written only
+// by the consumer and tail only by the producer, each on a cache line of
+// its own next to the other side's last seen copy.
+template <class T, size_t C>
+class spsc_ring {
+	using node_type = memory_node<sizeof (T) * C, node_alignment<T>::value>;
+	node_type * node;
+
+	alignas (cache_line_size) std::atomic<size_t> head;
+	size_t tail_seen;
+	alignas (cache_line_size) std::atomic<size_t> tail;
+	size_t head_seen;
+
+	T * slot (size_t pos) const
+		{ return (T *) node->memory + pos % C; }
+public:
+	spsc_ring ()
+	: node (get_memory_chain<sizeof (T) * C, node_alignment<T>::value>().pop()),
+	head (0), tail_seen (0), tail (0), head_seen (0)
+		{}
+	spsc_ring (const spsc_ring &) = delete;
+	// neither side may be running any more.
+	~spsc_ring ()
+	{
+		for (size_t i=head; i!=tail; i++)
+			slot (i)->~T();
+		node->chain->push (node);
+	}
+	// producer side; false when full.
+	bool try_push (T && t)
+	{
+		size_t pos = tail.load (std::memory_order_relaxed);
+		if (pos - head_seen == C) {
+			head_seen = head.load (std::memory_order_acquire);
+			if (pos - head_seen == C)
+				return false;
+		}
+		new (slot (pos)) T (std::move (t));
+		tail.store (pos + 1, std::memory_order_release);
+		return true;
+	}
+	// consumer side; false when empty.
+	bool try_pop (T & t)
+	{
+		size_t pos = head.load (std::memory_order_relaxed);
+		if (pos == tail_seen) {
+			tail_seen = tail.load (std::memory_order_acquire);
+			if (pos == tail_seen)
+				return false;
+		}
+		T * p = slot (pos);
+		t = std::move (* p);
+		p->~T();
+		head.store (pos + 1, std::memory_order_release);
+		return true;
+	}
+	// consumer side; moves up to max waiting elements to the back of vec.
+	template <size_t C2>
+	size_t drain (cached_ptr<T,C2> & vec, size_t max)
+	{
+		size_t pos = head.load (std::memory_order_relaxed);
+		tail_seen = tail.load (std::memory_order_acquire);
+		size_t n = tail_seen - pos < max ? tail_seen - pos : max;
+		size_t size = vec.size();
+		vec.reserve (size + n);
+		T * dst = vec.data() + size;
+		size_t run = n < C - pos % C ? n : C - pos % C;
+		relocate (dst, slot (pos), run);
+		relocate (dst + run, (T *) node->memory, n - run);
+		vec.resize_uninitialized (size + n);
+		head.store (pos + n, std::memory_order_release);
+		return n;
+	}
+};
+
+} // namespace
+
+#endif
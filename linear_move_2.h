@@ -12,14 +12,19 @@
 
 #include <initializer_list>
 
+#include <charconv>
 #include <iostream>
 #include <list>
 #include <vector>
 #include <memory>
 #include <cassert>
 #include <random>       // std::default_random_engine
+#include <type_traits>
+#include <functional>
+#include <cstring>
 
 #include "cached_ptr.h"
+#include "linear_move_2_simd.h"
 
 namespace lm2 {
 
@@ -34,7 +39,7 @@ public:
 	: p (NULL)
 		{}
 	ref_ptr (const T & t)
-	: p (&t)
+	: p (std::addressof (t))
 		{}
 	const T & operator * () const
 		{ return *p; }
@@ -67,23 +72,131 @@ std::ostream& operator<<(std::ostream & os, const cached_ptr <ref_ptr<T>,C> & ve
 	return os;
 }
 
-template <typename T, size_t C>
-std::ostream& operator<<(std::ostream & os, const cached_ptr <T,C> & vec)
+// numbers to_chars renders as a default ostream would; characters and
+// bools keep going through the stream.
+template <class T>
+struct text_number : std::integral_constant<bool,
+	std::is_arithmetic<T>::value && !std::is_same<T, bool>::value &&
+	!std::is_same<T, char>::value && !std::is_same<T, signed char>::value &&
+	!std::is_same<T, unsigned char>::value && !std::is_same<T, wchar_t>::value &&
+	!std::is_same<T, char16_t>::value && !std::is_same<T, char32_t>::value> {};
+
+// no flag, precision or locale that to_chars would not reproduce.
+inline bool plain_stream (std::ostream & os)
 {
-	os << "(";
-	size_t len = vec.size();
-	if (len) {
-		os << vec[0];
-		for(int i=1; i<len; i++) {
+	auto flags = std::ios::basefield | std::ios::floatfield | std::ios::showpos |
+		std::ios::showpoint | std::ios::uppercase;
+	return (os.flags () & flags) == std::ios::dec && os.precision () <= 32 &&
+		os.getloc () == std::locale::classic ();
+}
+
+// collects text in a pooled block and hands the stream whole blocks.
+class text_buffer {
+	static constexpr size_t block_size = 4096;
+	// more than to_chars needs for any number within plain_stream
+	static constexpr size_t number_room = 64;
+	std::ostream & os;
+	scratch_buffer<char, block_size> block;
+	char * cur;
+	int precision;
+public:
+	text_buffer (std::ostream & os)
+	: os (os), block (block_size), cur (block.data ()), precision (int (os.precision ()))
+		{}
+	text_buffer (const text_buffer &) = delete;
+	~text_buffer ()
+		{ flush (); }
+	void flush ()
+	{
+		os.write (block.data (), cur - block.data ());
+		cur = block.data ();
+	}
+	void put (char c)
+	{
+		if (cur == block.data () + block_size)
+			flush ();
+		*cur++ = c;
+	}
+	template <class T>
+	void put_number (T x)
+	{
+		char * end = block.data () + block_size;
+		if (size_t (end - cur) < number_room)
+			flush ();
+		if constexpr (std::is_floating_point<T>::value)
+			cur = std::to_chars (cur, end, x, std::chars_format::general, precision).ptr;
+		else
+			cur = std::to_chars (cur, end, x).ptr;
+	}
+};
+
+template <class T>
+void write_elements (std::ostream & os, const T * p, size_t len, bool lead, std::false_type)
+{
+	for (size_t i=0; i<len; i++) {
+		if (i || lead)
 			os << ' ';
-			os << vec[i];
-		}
+		os << p [i];
+	}
+}
+
+template <class T>
+void write_elements (std::ostream & os, const T * p, size_t len, bool lead, std::true_type)
+{
+	if (!plain_stream (os)) {
+		write_elements (os, p, len, lead, std::false_type ());
+		return;
+	}
+	text_buffer buffer (os);
+	for (size_t i=0; i<len; i++) {
+		if (i || lead)
+			buffer.put (' ');
+		buffer.put_number (p [i]);
+	}
+}
+
+// the first and the last k elements, with " ..." for what lies between.
+template <class T>
+std::ostream & write_text (std::ostream & os, const T * p, size_t len, size_t k)
+{
+	size_t head = k < len && len - k > k ? k : len;
+	os << "(";
+	write_elements (os, p, head, false, text_number<T> ());
+	if (head < len) {
+		os << (head ? " ..." : "...");
+		write_elements (os, p + len - k, k, true, text_number<T> ());
 	}
 	os << ")";
-	
 	return os;
 }
 
+template <class T, size_t C>
+std::ostream & write_text (std::ostream & os, const cached_ptr<T,C> & vec, size_t k)
+	{ return write_text (os, (const T *) vec.data(), vec.size(), k); }
+
+template <typename T, size_t C>
+std::ostream& operator<<(std::ostream & os, const cached_ptr <T,C> & vec)
+{
+	return write_text (os, vec, vec.size());
+}
+
+template <class T, size_t C>
+struct preview_of {
+	const cached_ptr<T,C> & vec;
+	size_t k;
+};
+
+// os << preview (vec, k) keeps logs of huge vectors short.
+template <class T, size_t C>
+preview_of<T,C> preview (const cached_ptr<T,C> & vec, size_t k)
+	{ return {vec, k}; }
+
+template <class T, size_t C>
+std::ostream & operator << (std::ostream & os, const preview_of<T,C> & p)
+{
+	return write_text (os, p.vec, p.k);
+}
+
 template <class T, size_t C>
 void display_of (const cached_ptr<T,C> & vec, const std::string & tag)
 {
@@ -114,7 +227,7 @@ T reduce (F && f, cached_ptr<T,C> && vec) {
 	assert (vec.size());
 	size_t len = vec.size();
 	T acc = std::move (vec[0]);
-	for (int i=1; i<len; i++)
+	for (size_t i=1; i<len; i++)
 		acc = f (std::move (acc), std::move (vec[i]));
 	return std::move (acc);
 }
@@ -122,11 +235,42 @@ T reduce (F && f, cached_ptr<T,C> && vec) {
 template <class A, class T, size_t C, class F>
 A fold (A && acc, F && f, cached_ptr<T,C> && vec) {
 	size_t len = vec.size();
-	for (int i=0; i<len; i++)
+	for (size_t i=0; i<len; i++)
 		acc = f (std::move (acc), std::move (vec[i]));
 	return std::move (acc);
 }
 
+// a plain sum of arithmetic elements into an accumulator of the same
+// type; floating point sums come out in a different order than the
+// loop above.
+template <class A, class T, size_t C, class P>
+typename std::enable_if<simd_arithmetic<T>::value &&
+	std::is_same<typename std::decay<A>::type, T>::value &&
+	(std::is_same<P, T>::value || std::is_same<P, void>::value), T>::type
+fold (A && acc, std::plus<P>, cached_ptr<T,C> && vec) {
+	return acc + simd_sum (vec.data(), vec.size());
+}
+
+template <class T, size_t C>
+T sum_of (cached_ptr<T,C> & vec) {
+	static_assert (simd_arithmetic<T>::value, "sum_of takes arithmetic elements");
+	return simd_sum (vec.data(), vec.size());
+}
+
+template <class T, size_t C>
+T min_of (cached_ptr<T,C> & vec) {
+	static_assert (simd_arithmetic<T>::value, "min_of takes arithmetic elements");
+	assert (vec.size());
+	return simd_min (vec.data(), vec.size());
+}
+
+template <class T, size_t C>
+T max_of (cached_ptr<T,C> & vec) {
+	static_assert (simd_arithmetic<T>::value, "max_of takes arithmetic elements");
+	assert (vec.size());
+	return simd_max (vec.data(), vec.size());
+}
+
 template <class A, class F>
 A loop (A && arg, F && f) {
 	while (std::get<0> (arg))
@@ -134,52 +278,297 @@ A loop (A && arg, F && f) {
 	return std::move (arg);
 }
 
+template <class T>
+void swap_elements (T & x, T & y) {
+	if (is_trivially_relocatable<T>::value) {
+		alignas (T) char tmp [sizeof (T)];
+		memcpy (tmp, (void *) std::addressof (x), sizeof (T));
+		memcpy ((void *) std::addressof (x), (void *) std::addressof (y), sizeof (T));
+		memcpy ((void *) std::addressof (y), tmp, sizeof (T));
+	} else
+		std::swap (x, y);
+}
+
 template <class T, size_t C>
 cached_ptr<T,C> reverse (cached_ptr<T,C> && vec) {
 	unsigned len = vec.size();
 	unsigned cnt = len / 2;
 	for (unsigned i=0; i<cnt; i++)
-		std::swap(vec [i], vec [len - 1 - i]);
+		swap_elements (vec [i], vec [len - 1 - i]);
 	return std::move (vec);
 }
 
+// ranges shorter than this are finished by insertion sort,
+// and ranges longer than ninther_cutoff take the pivot from nine samples.
+constexpr size_t insertion_sort_cutoff = 16;
+constexpr size_t ninther_cutoff = 128;
+
+// f (pivot, x) is true when x belongs before pivot. introsort: partitions
+// in place around a median pivot and falls back to heapsort once a range
+// has been split more than 2 log2 (n) times.
+template <class T, class F>
+struct sort_engine {
+	F & f;
+	T * vec;
+
+	static size_t depth_limit (size_t len) {
+		size_t depth = 0;
+		for (; len > 1; len >>= 1)
+			depth += 2;
+		return depth;
+	}
+	bool before (const T & x, const T & y)
+		{ return f (y, x); }
+	void insertion (size_t pos, size_t len) {
+		T * v = vec + pos;
+		for (size_t i = 1; i < len; i++) {
+			if (!before (v [i], v [i - 1]))
+				continue;
+			T t = std::move (v [i]);
+			size_t j = i;
+			for (; j > 0 && before (t, v [j - 1]); j--)
+				v [j] = std::move (v [j - 1]);
+			v [j] = std::move (t);
+		}
+	}
+	void sift (T * v, size_t root, size_t len) {
+		T t = std::move (v [root]);
+		size_t child;
+		while ((child = root * 2 + 1) < len) {
+			if (child + 1 < len && before (v [child], v [child + 1]))
+				child++;
+			if (!before (t, v [child]))
+				break;
+			v [root] = std::move (v [child]);
+			root = child;
+		}
+		v [root] = std::move (t);
+	}
+	void heap (size_t pos, size_t len) {
+		T * v = vec + pos;
+		for (size_t i = len / 2; i-- > 0;)
+			sift (v, i, len);
+		for (size_t i = len - 1; i > 0; i--) {
+			std::swap (v [0], v [i]);
+			sift (v, 0, i);
+		}
+	}
+	size_t median (T * v, size_t a, size_t b, size_t c) {
+		if (before (v [b], v [a]))
+			std::swap (a, b);
+		if (!before (v [c], v [b]))
+			return b;
+		return before (v [c], v [a]) ? a : c;
+	}
+	// returns the final position of the pivot; everything before it is
+	// not after it, and the other way round.
+	size_t partition (size_t pos, size_t len) {
+		T * v = vec + pos;
+		size_t mid = len / 2;
+		size_t m;
+		if (len > ninther_cutoff) {
+			size_t s = len / 8;
+			m = median (v,
+				median (v, 0, s, s * 2),
+				median (v, mid - s, mid, mid + s),
+				median (v, len - 1 - s * 2, len - 1 - s, len - 1));
+		} else
+			m = median (v, 0, mid, len - 1);
+		if (m)
+			std::swap (v [0], v [m]);
+
+		// both scans stop on keys equal to the pivot, so runs of equal
+		// keys are split down the middle.
+		size_t i = 0;
+		size_t j = len;
+		for (;;) {
+			while (++i < len && before (v [i], v [0]))
+				;
+			while (before (v [0], v [--j]))
+				;
+			if (i >= j)
+				break;
+			std::swap (v [i], v [j]);
+		}
+		if (j)
+			std::swap (v [0], v [j]);
+		return j;
+	}
+	// recurses into the smaller side and loops on the larger,
+	// so the stack stays within log2 (n) frames.
+	void recur (size_t pos, size_t len, size_t depth) {
+		while (len >= insertion_sort_cutoff) {
+			if (!depth) {
+				heap (pos, len);
+				return;
+			}
+			depth--;
+			size_t l_cnt = partition (pos, len);
+			size_t r_pos = pos + l_cnt + 1;
+			size_t r_cnt = len - l_cnt - 1;
+			if (l_cnt < r_cnt) {
+				recur (pos, l_cnt, depth);
+				pos = r_pos;
+				len = r_cnt;
+			} else {
+				recur (r_pos, r_cnt, depth);
+				len = l_cnt;
+			}
+		}
+		insertion (pos, len);
+	}
+};
+
 template <class T, size_t C, class F>
 cached_ptr<T,C> sort (F && f, cached_ptr<T,C> && vec) {
-	struct {
-		F & f;
-		cached_ptr<T,C> & vec;
-		void recur (unsigned pos, size_t len) {
-			thread_local char buf [(C - 1) * sizeof (T)];
-			thread_local T * div = (T *) buf;
-			
-			if (len < 2)
-				return;
-			
-			T t = std::move (vec [pos]);
-			
-			unsigned l_cnt = 0;
-			unsigned r_cnt = 0;
-
-			for (unsigned i = 1; i < len; i++)
-				if (f (t, vec [pos + i]))
-					div [l_cnt++] = std::move (vec [pos + i]);
-				else
-					div [len - ++r_cnt] = std::move (vec [pos + i]);
-			
-			for (unsigned i = 0; i < l_cnt; i++)
-				vec [pos + i] = std::move (div [i]);
-			
-			vec [pos + l_cnt] = std::move (t);
-			
-			unsigned r_pos = pos + l_cnt + 1;
-			for (unsigned i = 0; i < r_cnt; i++)
-				vec [r_pos + i] = std::move (div [len - (i + 1)]);
-			
-			recur (pos, l_cnt);
-			recur (r_pos, r_cnt);
+	size_t len = vec.size();
+	sort_engine<T, F> self = {f, vec.data()};
+	self.recur (0, len, self.depth_limit (len));
+	return std::move (vec);
+}
+
+// stable sort on key (x). keys are taken once and sorted together with
+// the index they came from, and then the records are moved into place in
+// one pass. integral keys go through an LSD radix sort, one byte per pass,
+// and anything else ordered by < through a merge sort.
+template <class T, size_t C, class K>
+struct key_sort {
+	using R = typename std::decay<typename std::result_of<K(const T &)>::type>::type;
+	struct entry {
+		R key;
+		size_t from;
+	};
+
+	K & key;
+	T * vec;
+	size_t len;
+
+	// from (i) is the index whose record belongs at i; follows every cycle
+	// once, and marks each slot done by pointing it at itself.
+	template <class F>
+	void permute (F && from) {
+		for (size_t i = 0; i < len; i++) {
+			if (from (i) == i)
+				continue;
+			T t = std::move (vec [i]);
+			size_t j = i;
+			while (from (j) != i) {
+				size_t next = from (j);
+				vec [j] = std::move (vec [next]);
+				from (j) = j;
+				j = next;
+			}
+			vec [j] = std::move (t);
+			from (j) = j;
+		}
+	}
+
+	void run (std::true_type) {
+		using U = typename std::make_unsigned<R>::type;
+		constexpr size_t digits = sizeof (U);
+		// flipping the sign bit orders signed keys as unsigned ones
+		constexpr U sign = std::is_signed<R>::value ? U (U (1) << (digits * 8 - 1)) : U (0);
+
+		scratch_buffer<U,C> keys (len);
+		scratch_buffer<U,C> keys2 (len);
+		scratch_buffer<size_t,C> index (len);
+		scratch_buffer<size_t,C> index2 (len);
+		U * k = keys.data();
+		U * k2 = keys2.data();
+		size_t * x = index.data();
+		size_t * x2 = index2.data();
+
+		size_t counts [digits][256] = {};
+		for (size_t i = 0; i < len; i++) {
+			k [i] = U (key (vec [i])) ^ sign;
+			x [i] = i;
+			for (size_t d = 0; d < digits; d++)
+				counts [d][(k [i] >> (d * 8)) & 255]++;
+		}
+
+		for (size_t d = 0; d < digits; d++) {
+			size_t * count = counts [d];
+			size_t shift = d * 8;
+			// every key shares this byte
+			if (count [(k [0] >> shift) & 255] == len)
+				continue;
+			size_t total = 0;
+			for (size_t b = 0; b < 256; b++) {
+				size_t cnt = count [b];
+				count [b] = total;
+				total += cnt;
+			}
+			for (size_t i = 0; i < len; i++) {
+				size_t pos = count [(k [i] >> shift) & 255]++;
+				k2 [pos] = k [i];
+				x2 [pos] = x [i];
+			}
+			std::swap (k, k2);
+			std::swap (x, x2);
+		}
+		permute ([x] (size_t i) -> size_t & { return x [i]; });
+	}
+
+	static bool less (const entry & x, const entry & y)
+		{ return x.key < y.key; }
+	static void insertion (entry * v, size_t n) {
+		for (size_t i = 1; i < n; i++) {
+			if (!less (v [i], v [i - 1]))
+				continue;
+			entry t = std::move (v [i]);
+			size_t j = i;
+			for (; j > 0 && less (t, v [j - 1]); j--)
+				v [j] = std::move (v [j - 1]);
+			v [j] = std::move (t);
+		}
+	}
+	// the left half waits in buf while both halves merge back into v.
+	static void merge (entry * v, size_t n, entry * buf) {
+		if (n < insertion_sort_cutoff) {
+			insertion (v, n);
+			return;
 		}
-	} self = {f, vec};
-	self.recur (0, vec.size());
+		size_t mid = n / 2;
+		merge (v, mid, buf);
+		merge (v + mid, n - mid, buf);
+		if (!less (v [mid], v [mid - 1]))
+			return;
+		for (size_t i = 0; i < mid; i++)
+			new (buf + i) entry (std::move (v [i]));
+		size_t i = 0;
+		size_t j = mid;
+		size_t k = 0;
+		while (i < mid && j < n)
+			if (less (v [j], buf [i]))
+				v [k++] = std::move (v [j++]);
+			else
+				v [k++] = std::move (buf [i++]);
+		while (i < mid)
+			v [k++] = std::move (buf [i++]);
+		for (size_t i = 0; i < mid; i++)
+			buf [i].~entry();
+	}
+	void run (std::false_type) {
+		scratch_buffer<entry,C> entries (len);
+		scratch_buffer<entry,C> scratch (len);
+		entry * e = entries.data();
+		for (size_t i = 0; i < len; i++)
+			new (e + i) entry {key (vec [i]), i};
+		merge (e, len, scratch.data());
+		permute ([e] (size_t i) -> size_t & { return e [i].from; });
+		for (size_t i = 0; i < len; i++)
+			e [i].~entry();
+	}
+};
+
+template <class T, size_t C, class K>
+cached_ptr<T,C> sort_by_key (K && key, cached_ptr<T,C> && vec) {
+	using R = typename key_sort<T, C, K>::R;
+	if (vec.size() < 2)
+		return std::move (vec);
+	key_sort<T, C, K> self = {key, vec.data(), vec.size()};
+	self.run (std::integral_constant<bool,
+		std::is_integral<R>::value && !std::is_same<R, bool>::value> ());
 	return std::move (vec);
 }
 
@@ -195,6 +584,12 @@ size_t find_of (cached_ptr<T,C> & vec, F && f) {
 	return ret;
 }
 
+template <class T, size_t C, cmp_op O>
+typename std::enable_if<simd_arithmetic<T>::value, size_t>::type
+find_of (cached_ptr<T,C> & vec, cmp<O,T> f) {
+	return simd_find (vec.data(), vec.size(), f);
+}
+
 template <class T, size_t C>
 cached_ptr<T,C> shuffle (cached_ptr<T,C> && vec) {
 	std::random_device rd;
@@ -210,9 +605,7 @@ cached_ptr<T,C> shuffle (cached_ptr<T,C> && vec) {
 
 template <class T, size_t C>
 cached_ptr<T,C> append (T && t, cached_ptr<T,C> && vec) {
-	size_t size = vec.size();
-	vec.resize (size + 1);
-	vec [size] = std::move (t);
+	vec.push_back (std::move (t));
 	return std::move (vec);
 }
 
@@ -221,6 +614,9 @@ bool compare (const cached_ptr<T,C1> & vec1, const cached_ptr<T,C2> & vec2) {
 	size_t len = vec1.size();
 	if (len != vec2.size())
 		return false;
+	// equal exactly when the bytes are
+	if (std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value)
+		return !len || !memcmp (vec1.data(), vec2.data(), len * sizeof (T));
 	for (size_t i=0; i<len; i++) {
 		T & t1 = vec1 [i];
 		T & t2 = vec2 [i];
@@ -243,32 +639,36 @@ bool compare (const cached_ptr<cached_ptr<T,C>, CC1> & vec1, const cached_ptr<ca
 
 template <class T, size_t C>
 cached_ptr<T,C> combine (cached_ptr<T,C> && vec, cached_ptr<T,C> && vec2) {
-	size_t pre_len = vec.size();
-	size_t new_len = pre_len + vec2.size();
-	vec.resize (new_len);
-	for (size_t i=pre_len; i<new_len; i++)
-		vec[i] = std::move (vec2 [i - pre_len]);
+	relocate_back (vec, vec2.data(), vec2.size());
+	vec2.resize_uninitialized (0);
 	return std::move (vec);
 }
 
 template <class T, size_t C>
 cached_ptr<T,C> take (size_t len, cached_ptr<T,C> && vec) {
 	assert (len < vec.size());
-	vec.resize (len);
+	// only ever shrinks, so the growing half of resize stays out
+	if (!std::is_trivially_destructible<T>::value)
+		for (size_t i=len; i<vec.size(); i++)
+			vec [i].~T();
+	vec.resize_uninitialized (len);
 	return std::move (vec);
 }
 
 template <class T, size_t C>
 cached_ptr<T,C> drop (size_t len, cached_ptr<T,C> && vec) {
 	assert (len < vec.size());
-	size_t cnt = vec.size() - len;
-	for (int i=0; i<cnt; i++)
-		vec [i] = std::move (vec[i + len]);
-	vec.resize (vec.size() - len);
+	vec.drop_front (len);
 
 	return std::move (vec);
 }
 
+template <class T, size_t C>
+cached_ptr<T,C> drop_first (size_t i, cached_ptr<T,C> && vec) {
+	vec.drop_front (i);
+	return std::move (vec);
+}
+
 template <class T, size_t C, class F>
 cached_ptr<T,C> drop_while (F && f, cached_ptr<T,C> && vec) {
 	size_t len = vec.size();
@@ -276,11 +676,23 @@ cached_ptr<T,C> drop_while (F && f, cached_ptr<T,C> && vec) {
 	for (; i<len; i++)
 		if (!f (vec [i]))
 			break;
+	return drop_first (i, std::move (vec));
+}
+
+template <class T, size_t C, cmp_op O>
+typename std::enable_if<simd_arithmetic<T>::value, cached_ptr<T,C>>::type
+drop_while (cmp<O,T> f, cached_ptr<T,C> && vec) {
+	return drop_first (simd_find (vec.data(), vec.size(), !f), std::move (vec));
+}
+
+template <class T, size_t C>
+cached_ptr<T,C> take_first (size_t i, cached_ptr<T,C> && vec) {
+	size_t len = vec.size();
 	if (!i)
-		return std::move (vec);
+		return cached_ptr<T,C> ();
 	if (i == len)
-		return cached_ptr<T,C>();
-	return drop (i, std::move (vec));
+		return std::move (vec);
+	return take (i, std::move (vec));
 }
 
 template <class T, size_t C, class F>
@@ -290,43 +702,72 @@ cached_ptr<T,C> take_while (F && f, cached_ptr<T,C> && vec) {
 	for (; i<len; i++)
 		if (!f (vec [i]))
 			break;
-	if (!i)
-		return cached_ptr<T,C> ();
-	if (i == len)
-		return std::move (vec);
-	return take (i, std::move (vec));
+	return take_first (i, std::move (vec));
+}
+
+template <class T, size_t C, cmp_op O>
+typename std::enable_if<simd_arithmetic<T>::value, cached_ptr<T,C>>::type
+take_while (cmp<O,T> f, cached_ptr<T,C> && vec) {
+	return take_first (simd_find (vec.data(), vec.size(), !f), std::move (vec));
 }
 
 template <class T, size_t C, size_t C2>
 cached_ptr<T,C> join (cached_ptr<cached_ptr<T,C>,C2> && vec_vec) {
 	size_t vec_vec_len = vec_vec.size();
 	size_t len = 0;
-	for (int i=0; i<vec_vec_len; i++) {
+	for (size_t i=0; i<vec_vec_len; i++) {
 		size_t vec_len = vec_vec[i].size ();
 		len += vec_len;
 	}
-	cached_ptr<T,C> ret; // (len);
+	cached_ptr<T,C> ret;
+	ret.reserve (len);
 	for (size_t i=0; i<vec_vec_len; i++) {
 		cached_ptr <T,C> & vec = vec_vec [i];
-		size_t vec_len = vec.size ();
-		for (size_t j=0; j<vec_len; j++)
-			ret.push_back (std::move (vec [j]));
+		relocate_back (ret, vec.data(), vec.size ());
+		vec.resize_uninitialized (0);
 	}
 	return std::move (ret);
 }
 
-template <class T, size_t C, class F>
-auto map (F && f, cached_ptr<T,C> && vec)
--> cached_ptr<typename std::result_of<F(T)>::type, C>
+template <class R, class T, size_t C, class F>
+cached_ptr<R,C> map_to (F & f, cached_ptr<T,C> && vec, std::false_type)
 {
 	size_t len = vec.size();
-	cached_ptr<typename std::result_of<F(T)>::type, C> ret;
-	for (size_t i=0; i < len; i++)
-		ret.push_back (f (std::move (vec[i])));
+	cached_ptr<R,C> ret;
+	// nothing to clean up if f throws: a plain loop the compiler can vectorize
+	if (std::is_trivially_destructible<R>::value) {
+		ret.reserve (len);
+		T * src = vec.data();
+		R * dst = ret.data();
+		for (size_t i=0; i < len; i++)
+			new (dst + i) R (f (std::move (src [i])));
+		ret.resize_uninitialized (len);
+	} else
+		for (size_t i=0; i < len; i++)
+			ret.push_back (f (std::move (vec[i])));
 
 	return std::move (ret);
 }
 
+// same element type: the results overwrite the consumed vec in place.
+template <class R, class T, size_t C, class F>
+cached_ptr<T,C> map_to (F & f, cached_ptr<T,C> && vec, std::true_type)
+{
+	size_t len = vec.size();
+	for (size_t i=0; i < len; i++)
+		vec[i] = f (std::move (vec[i]));
+
+	return std::move (vec);
+}
+
+template <class T, size_t C, class F>
+auto map (F && f, cached_ptr<T,C> && vec)
+-> cached_ptr<typename std::result_of<F(T)>::type, C>
+{
+	using R = typename std::result_of<F(T)>::type;
+	return map_to<R> (f, std::move (vec), std::is_same<R, T> ());
+}
+
 template <class F>
 auto let (F && f)
 -> typename std::result_of<F()>::type
@@ -386,8 +827,17 @@ U fold_of (cached_ptr<T,C> & vec, U && acc, F && f)
 	return std::move (acc);
 }
 
+// arithmetic elements are compacted by simd_compact, without branches;
+// it hands f a copy, so only predicates that read their argument go there.
 template <class T, size_t C, class F>
-cached_ptr<T,C> filter (F && f, cached_ptr<T,C> && vec) {
+cached_ptr<T,C> filter_in (F & f, cached_ptr<T,C> && vec, std::true_type) {
+	vec.resize (simd_compact (vec.data(), vec.data(), vec.size(), f));
+
+	return std::move (vec);
+}
+
+template <class T, size_t C, class F>
+cached_ptr<T,C> filter_in (F & f, cached_ptr<T,C> && vec, std::false_type) {
 	size_t len = vec.size();
 	size_t cnt = 0;
 	for (size_t i=0; i<len; i++) {
@@ -403,6 +853,13 @@ cached_ptr<T,C> filter (F && f, cached_ptr<T,C> && vec) {
 	return std::move (vec);
 }
 
+template <class T, size_t C, class F>
+cached_ptr<T,C> filter (F && f, cached_ptr<T,C> && vec) {
+	using P = typename std::decay<F>::type;
+	return filter_in (f, std::move (vec), std::integral_constant<bool,
+		simd_arithmetic<T>::value && const_predicate<P, T>::value> ());
+}
+
 template <size_t RC, class T, size_t C, class F>
 cached_ptr<cached_ptr<T,C>, RC> assort (/*size_t cnt,*/ F && f, cached_ptr <T,C> && vec) {
 	size_t len = vec.size();
@@ -413,8 +870,9 @@ cached_ptr<cached_ptr<T,C>, RC> assort (/*size_t cnt,*/ F && f, cached_ptr <T,C>
 		T & e = vec [i];
 		size_t pos = f (e);
 		assert (pos < RC/*cnt*/);
-		ret[pos].push_back (std::move (e));
+		relocate_back (ret[pos], vec.data() + i, 1);
 	}
+	vec.resize_uninitialized (0);
 
 	return std::move (ret);
 }
@@ -428,14 +886,14 @@ cached_ptr<cached_ptr<T,C>, C / L> group (cached_ptr<T,C> && vec) {
 	size_t src_pos = 0;
 	for (size_t i=0; i < group_cnt; i++) {
 		ret.push_back (cached_ptr<T,C>());
-		for (int j=0; j < L; j++)
-			ret[i].push_back (std::move (vec[src_pos++]));
+		relocate_back (ret[i], vec.data() + src_pos, L);
+		src_pos += L;
 	}
 	if (rest_cnt) {
 		ret.push_back (cached_ptr<T,C>());
-		for (int j=0; j < rest_cnt; j++)
-			ret[group_cnt].push_back (std::move (vec [src_pos++]));
+		relocate_back (ret[group_cnt], vec.data() + src_pos, rest_cnt);
 	}
+	vec.resize_uninitialized (0);
 	return std::move (ret);
 }
 
@@ -448,14 +906,14 @@ cached_ptr<cached_ptr<T,C>, C2> group (unsigned cnt, cached_ptr<T,C> && vec) {
 	size_t src_pos = 0;
 	for (size_t i=0; i < group_cnt; i++) {
 		ret.push_back (cached_ptr<T,C>());
-		for (int j=0; j < cnt; j++)
-			ret[i].push_back (std::move (vec[src_pos++]));
+		relocate_back (ret[i], vec.data() + src_pos, cnt);
+		src_pos += cnt;
 	}
 	if (rest_cnt) {
 		ret.push_back (cached_ptr<T,C>());
-		for (int j=0; j < rest_cnt; j++)
-			ret[group_cnt].push_back (std::move (vec [src_pos++]));
+		relocate_back (ret[group_cnt], vec.data() + src_pos, rest_cnt);
 	}
+	vec.resize_uninitialized (0);
 	return std::move (ret);
 }
 
@@ -464,7 +922,7 @@ cached_ptr<T *, C> refdup (cached_ptr<T,C> & vec) {
 	size_t len = vec.size();
 	cached_ptr<T *, C> ret; // (len);
 	for (size_t i = 0; i < len; i++)
-		ret.push_back (&vec [i]);
+		ret.push_back (std::addressof (vec [i]));
 	return std::move (ret);
 }
 
@@ -0,0 +1,696 @@
+//
+//  linear_move_2_bench.cpp
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "cached_ptr.h"
+#include "memory_arena.h"
+#include "linear_move_2_parallel.h"
+#include "linear_move_2_view.h"
+#include "cached_ring.h"
+#include "cached_file.h"
+#include "linear_move_2_test.h"
+
+using namespace lm2;
+
+struct inline_int {
+	int num;
+};
+
+struct node_int {
+	int num;
+};
+
+namespace lm2 {
+template <>
+struct inline_storage<node_int, 1> : std::false_type {};
+} // namespace
+
+std::atomic<int> Fuga::copy_cnt (0);
+std::atomic<int> Fuga::life_cnt (0);
+std::atomic<int> Fuga::move_cnt (0);
+std::atomic<int> Hoge::copy_cnt (0);
+std::atomic<int> Hoge::life_cnt (0);
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since (bench_clock::time_point start)
+{
+	return std::chrono::duration<double> (bench_clock::now() - start).count();
+}
+
+// the mutex-guarded reserved list memory_chain used before, kept as a baseline.
+template <size_t C>
+class locked_chain {
+	memory_node <C> * chain;
+	memory_node <C> * reserved;
+	std::thread::id thread_id;
+	std::mutex mutex;
+public:
+	locked_chain ()
+	: chain (nullptr), reserved (nullptr),
+	thread_id (std::this_thread::get_id())
+		{}
+	~locked_chain ()
+	{
+		unreserve ();
+		while (chain) {
+			auto node = chain;
+			chain = chain->next;
+			delete node;
+		}
+	}
+	void reserve (memory_node<C> * node) {
+		std::lock_guard<std::mutex> lock (mutex);
+		node->next = reserved;
+		reserved = node;
+	}
+	void push (memory_node<C> * node)
+	{
+		if (thread_id != std::this_thread::get_id()) {
+			reserve (node);
+			return;
+		}
+		node->next = chain;
+		chain = node;
+	}
+	void unreserve ()
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		while (reserved) {
+			auto node = reserved;
+			reserved = node->next;
+			node->next = chain;
+			chain = node;
+		}
+	}
+	memory_node<C> * pop ()
+	{
+		if (reserved)
+			unreserve();
+		auto ret = chain;
+		if (ret)
+			chain = ret->next;
+		else
+			ret = new memory_node<C>;
+		return ret;
+	}
+};
+
+// the owner pops every node, `threads` workers free their share
+// remotely, then the owner pops them all back.
+template <class Chain, size_t C>
+double remote_free (unsigned threads, unsigned total)
+{
+	// on the heap, as get_memory_chain keeps its chains
+	std::unique_ptr<Chain> owner (new Chain);
+	Chain & chain = * owner;
+	std::vector<memory_node<C> *> nodes (total);
+	for (auto & node : nodes)
+		node = chain.pop ();
+	for (auto node : nodes)
+		chain.push (node);
+
+	double best = 0;
+	for (int round=0; round<5; round++) {
+		for (auto & node : nodes)
+			node = chain.pop ();
+		std::atomic<unsigned> ready (0);
+		std::atomic<bool> go (false);
+		std::vector<std::thread> workers;
+		unsigned share = total / threads;
+		for (unsigned t=0; t<threads; t++)
+			workers.emplace_back ([&, t] () {
+				size_t begin = t * share;
+				size_t end = t + 1 == threads ? total : begin + share;
+				ready++;
+				while (!go)
+					std::this_thread::yield ();
+				for (size_t i=begin; i<end; i++)
+					chain.push (nodes [i]);
+			});
+		while (ready != threads)
+			std::this_thread::yield ();
+		auto start = bench_clock::now ();
+		go = true;
+		for (auto & worker : workers)
+			worker.join ();
+		for (auto & node : nodes)
+			node = chain.pop ();
+		double rate = total / seconds_since (start);
+		if (rate > best)
+			best = rate;
+		for (auto node : nodes)
+			chain.push (node);
+	}
+	return best;
+}
+
+void remote_free__bench ()
+{
+	const unsigned total = 1 << 20;
+	puts ("remote_free__bench # nodes/sec, best of 5");
+	printf ("%8s %14s %14s %8s\n", "threads", "mutex", "lock-free", "ratio");
+	for (unsigned threads=1; threads<=64; threads*=2) {
+		double locked = remote_free<locked_chain<64>, 64> (threads, total);
+		double lock_free = remote_free<memory_chain<64>, 64> (threads, total);
+		printf ("%8u %14.0f %14.0f %8.2f\n", threads, locked, lock_free, lock_free / locked);
+	}
+}
+
+// pre-warms `len` nodes and touches every page once, as a fresh worker would.
+template <class Backend, size_t C>
+double cold_start (unsigned len)
+{
+	using node_type = memory_node<C>;
+	std::vector<node_type *> nodes;
+	auto start = bench_clock::now ();
+	Backend::template allocate_bulk<node_type> (len,
+		[&] (node_type * node) {
+			nodes.push_back (node);
+		});
+	for (auto node : nodes) {
+		volatile char * memory = node->memory;
+		for (size_t i=0; i<C; i+=4096)
+			memory [i] = 1;
+	}
+	double elapsed = seconds_since (start);
+	for (auto node : nodes)
+		Backend::deallocate (node);
+	return elapsed;
+}
+
+void cold_start__bench ()
+{
+	const unsigned len = 32;
+	puts ("cold_start__bench # make_memory_cache<800000>(32) + first touch, msec");
+	printf ("%24s %10.3f\n", "heap", cold_start<heap_backend, 800000> (len) * 1e3);
+	printf ("%24s %10.3f\n", "arena", cold_start<arena_backend<huge_pages::none>, 800000> (len) * 1e3);
+	printf ("%24s %10.3f\n", "arena + THP", cold_start<arena_backend<huge_pages::transparent>, 800000> (len) * 1e3);
+	printf ("%24s %10.3f\n", "arena + MAP_HUGETLB", cold_start<arena_backend<huge_pages::hugetlb>, 800000> (len) * 1e3);
+}
+
+// builds and folds a vector of one-element vectors.
+template <class T>
+double nested (unsigned rounds)
+{
+	const int len = 1000;
+	long sum = 0;
+	auto start = bench_clock::now ();
+	for (unsigned round=0; round<rounds; round++) {
+		cached_ptr<cached_ptr<T>, len> vec;
+		for (int i=0; i<len; i++)
+			vec.push_back (cached_ptr<T> (T {i}));
+		for (int i=0; i<len; i++)
+			sum += vec [i]->num;
+	}
+	double elapsed = seconds_since (start);
+	if (sum != (long) rounds * len * (len - 1) / 2)
+		puts ("...something wrong!");
+	return elapsed * 1e9 / ((double) rounds * len);
+}
+
+void nested__bench ()
+{
+	const unsigned rounds = 2000;
+	puts ("nested__bench # cached_ptr<cached_ptr<T>,1000>, nsec/element");
+	printf ("%24s %10.2f\n", "node", nested<node_int> (rounds));
+	printf ("%24s %10.2f\n", "inline", nested<inline_int> (rounds));
+}
+
+// sorts the same sequence with std::sort on a std::vector,
+// lm2::sort, and lm2::sort on a pool.
+template <class T, size_t C>
+void sort_of (const char * name, ThreadPool & pool, const std::vector<int> & nums)
+{
+	auto make = [&] () {
+		cached_ptr<T, C> vec;
+		for (int num : nums)
+			vec.push_back (T (num));
+		return vec;
+	};
+	auto less = [] (const T & x, const T & y) {
+		return x.get_num() < y.get_num();
+	};
+	// lm2 comparators are f (pivot, x), true when x goes first
+	auto before = [] (const T & pivot, const T & x) {
+		return x.get_num() < pivot.get_num();
+	};
+
+	std::vector<T> std_vec;
+	for (int num : nums)
+		std_vec.emplace_back (num);
+	auto start = bench_clock::now ();
+	std::sort (std_vec.begin (), std_vec.end (), less);
+	double std_time = seconds_since (start);
+
+	auto vec = make ();
+	start = bench_clock::now ();
+	vec = sort (before, std::move (vec));
+	double serial_time = seconds_since (start);
+
+	auto par = make ();
+	start = bench_clock::now ();
+	par = sort (pool, before, std::move (par));
+	double parallel_time = seconds_since (start);
+
+	for (size_t i=0; i<nums.size(); i++)
+		if (vec [i] != std_vec [i] || par [i] != std_vec [i]) {
+			puts ("...something wrong!");
+			break;
+		}
+	printf ("%24s %10.2f %10.2f %10.2f\n", name,
+		std_time * 1e3, serial_time * 1e3, parallel_time * 1e3);
+}
+
+void sort__bench ()
+{
+	const int len = 1000000;
+	unsigned threads = std::max (std::thread::hardware_concurrency (), 2u) - 1;
+	ThreadPool pool (threads);
+	printf ("sort__bench # 1M elements, msec, pool of %u + caller\n", threads);
+	printf ("%24s %10s %10s %10s\n", "", "std::sort", "lm2", "lm2 pool");
+
+	std::vector<int> random (len), sorted (len), reversed (len), organ (len);
+	std::mt19937 mt (len);
+	for (int i=0; i<len; i++) {
+		random [i] = mt ();
+		sorted [i] = i;
+		reversed [i] = len - i;
+		organ [i] = i < len / 2 ? i : len - i;
+	}
+	sort_of<Fuga, len> ("Fuga random", pool, random);
+	sort_of<Fuga, len> ("Fuga sorted", pool, sorted);
+	sort_of<Fuga, len> ("Fuga reversed", pool, reversed);
+	sort_of<Fuga, len> ("Fuga organ-pipe", pool, organ);
+	sort_of<Hoge, len> ("Hoge random", pool, random);
+	sort_of<Hoge, len> ("Hoge sorted", pool, sorted);
+	sort_of<Hoge, len> ("Hoge reversed", pool, reversed);
+	sort_of<Hoge, len> ("Hoge organ-pipe", pool, organ);
+}
+
+// 100k records by integer key: std::stable_sort, lm2::sort,
+// and sort_by_key on the int key (radix) and a double key (merge).
+template <class T>
+void sort_by_key_of (const char * name, const std::vector<int> & nums)
+{
+	const size_t len = 100000;
+	auto make = [&] () {
+		cached_ptr<T, len> vec;
+		for (int num : nums)
+			vec.push_back (T (num));
+		return vec;
+	};
+	std::vector<T> std_vec;
+	for (int num : nums)
+		std_vec.emplace_back (num);
+	auto start = bench_clock::now ();
+	std::stable_sort (std_vec.begin (), std_vec.end (),
+		[] (const T & x, const T & y) {
+			return x.get_num() < y.get_num();
+		});
+	double std_time = seconds_since (start);
+
+	auto vec = make ();
+	start = bench_clock::now ();
+	vec = sort (
+		[] (const T & pivot, const T & x) {
+			return x.get_num() < pivot.get_num();
+		},
+		std::move (vec));
+	double sort_time = seconds_since (start);
+
+	auto radix = make ();
+	start = bench_clock::now ();
+	radix = sort_by_key (
+		[] (const T & x) {
+			return x.get_num();
+		},
+		std::move (radix));
+	double radix_time = seconds_since (start);
+
+	auto merged = make ();
+	start = bench_clock::now ();
+	merged = sort_by_key (
+		[] (const T & x) {
+			return (double) x.get_num();
+		},
+		std::move (merged));
+	double merge_time = seconds_since (start);
+
+	for (size_t i=0; i<len; i++)
+		if (vec [i] != std_vec [i] || radix [i] != std_vec [i] || merged [i] != std_vec [i]) {
+			puts ("...something wrong!");
+			break;
+		}
+	printf ("%24s %10.2f %10.2f %10.2f %10.2f\n", name,
+		std_time * 1e3, sort_time * 1e3, radix_time * 1e3, merge_time * 1e3);
+}
+
+void sort_by_key__bench ()
+{
+	const int len = 100000;
+	std::vector<int> nums (len);
+	std::mt19937 mt (len);
+	for (auto & num : nums)
+		num = mt ();
+	puts ("sort_by_key__bench # 100k random keys, msec");
+	printf ("%24s %10s %10s %10s %10s\n", "", "stable", "lm2 sort", "radix", "merge");
+	sort_by_key_of<Fuga> ("Fuga", nums);
+	sort_by_key_of<Hoge> ("Hoge", nums);
+}
+
+// take_while, map, filter and fold over 1M Hoge: one pass and node per
+// stage, against a single fused pass through a view.
+void view__bench ()
+{
+	const int len = 1000000;
+	auto keep = [] (const Hoge & hoge) {
+		return hoge.get_num() < len - 10;
+	};
+	auto twice = [] (Hoge && hoge) {
+		return Fuga (hoge.get_num() * 2);
+	};
+	auto thirds = [] (const Fuga & fuga) {
+		return !(fuga.get_num() % 3);
+	};
+	auto sum = [] (long && acc, Fuga && fuga) {
+		return acc + fuga.get_num();
+	};
+	puts ("view__bench # 1M Hoge, take_while | map | filter | fold, msec");
+
+	auto hoges = make_hoges<len> (len);
+	auto start = bench_clock::now ();
+	long eager = fold (0L, sum, filter (thirds, map (twice, take_while (keep, std::move (hoges)))));
+	printf ("%24s %10.2f\n", "eager", seconds_since (start) * 1e3);
+
+	hoges = make_hoges<len> (len);
+	start = bench_clock::now ();
+	long fused = view (std::move (hoges)) | take_while (keep) | map (twice) | filter (thirds) | fold (0L, sum);
+	printf ("%24s %10.2f\n", "fused", seconds_since (start) * 1e3);
+	if (eager != fused)
+		puts ("...something wrong!");
+}
+
+// the generic element loops against the simd kernels on 1M elements.
+template <class T>
+void simd_of (const char * name)
+{
+	const int len = 1000000;
+	const int rounds = 20;
+	auto make = [] () {
+		return progress<len> (len, T (0), [] (T x) { return T (int (x + 1) % 1000); });
+	};
+	auto nums = make ();
+	T sink = 0;
+
+	auto start = bench_clock::now ();
+	for (int round=0; round<rounds; round++)
+		sink += fold_of (nums, T (0), [] (T && acc, const T & x) { return acc + x; });
+	double fold_time = seconds_since (start) / rounds;
+	start = bench_clock::now ();
+	for (int round=0; round<rounds; round++)
+		sink += sum_of (nums);
+	double sum_time = seconds_since (start) / rounds;
+
+	start = bench_clock::now ();
+	for (int round=0; round<rounds; round++)
+		sink += find_of (nums, [] (const T & x) { return x > T (1000); });
+	double find_time = seconds_since (start) / rounds;
+	start = bench_clock::now ();
+	for (int round=0; round<rounds; round++)
+		sink += find_of (nums, cmp_gt (T (1000)));
+	double cmp_time = seconds_since (start) / rounds;
+
+	auto odd = [] (T x) { return int (x) % 2 != 0; };
+	double loop_time = 0;
+	double compact_time = 0;
+	for (int round=0; round<rounds; round++) {
+		auto vec = make ();
+		start = bench_clock::now ();
+		vec = filter_in (odd, std::move (vec), std::false_type ());
+		loop_time += seconds_since (start) / rounds;
+		sink += vec.size();
+		vec = make ();
+		start = bench_clock::now ();
+		vec = filter (odd, std::move (vec));
+		compact_time += seconds_since (start) / rounds;
+		sink += vec.size();
+	}
+	if (sink == T (-1))
+		puts ("");
+	printf ("%24s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", name,
+		fold_time * 1e3, sum_time * 1e3, find_time * 1e3, cmp_time * 1e3,
+		loop_time * 1e3, compact_time * 1e3);
+}
+
+void simd__bench ()
+{
+	static const char * levels [] = {"generic", "avx2", "avx512"};
+	printf ("simd__bench # 1M elements, msec, dispatching to %s\n", levels [int (simd_support ())]);
+	printf ("%24s %8s %8s %8s %8s %8s %8s\n", "", "fold", "sum_of", "find_of", "cmp", "filter", "compact");
+	simd_of<int> ("int");
+	simd_of<float> ("float");
+	simd_of<double> ("double");
+}
+
+// consumes a 1M element buffer in prefixes of 16, as a streaming reader would.
+void drop__bench ()
+{
+	const int len = 1000000;
+	const int step = 16;
+	auto hoges = make_hoges<len> (len);
+	long sum = 0;
+	auto start = bench_clock::now ();
+	while (hoges.size() > step) {
+		for (int i=0; i<step; i++)
+			sum += hoges [i].get_num();
+		hoges = drop (step, std::move (hoges));
+	}
+	double elapsed = seconds_since (start);
+	long taken = len - long (hoges.size());
+	if (sum != taken * (taken + 1) / 2)
+		puts ("...something wrong!");
+	puts ("drop__bench # 1M Hoge dropped 16 at a time, nsec/drop");
+	printf ("%24s %10.2f\n", "drop", elapsed * 1e9 / (len / step));
+}
+
+// one producer task hands ints over to this thread.
+template <class Q>
+double handoff (Q & queue, int len)
+{
+	ThreadPool pool (1);
+	auto start = bench_clock::now ();
+	auto producer = pool.enqueue ([&queue, len] () {
+		for (int i=1; i<=len; i++)
+			while (!queue.push (i))
+				std::this_thread::yield ();
+	});
+	long sum = 0;
+	for (int i=0; i<len; ) {
+		int x;
+		if (queue.pop (x)) {
+			sum += x;
+			i++;
+		} else
+			std::this_thread::yield ();
+	}
+	producer.get ();
+	if (sum != (long) len * (len + 1) / 2)
+		puts ("...something wrong!");
+	return seconds_since (start);
+}
+
+struct locked_deque {
+	std::mutex mutex;
+	std::deque<int> deque;
+	bool push (int x)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		if (deque.size() == 1024)
+			return false;
+		deque.push_back (x);
+		return true;
+	}
+	bool pop (int & x)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		if (deque.empty())
+			return false;
+		x = deque.front ();
+		deque.pop_front ();
+		return true;
+	}
+};
+
+struct ring_queue {
+	spsc_ring<int, 1024> ring;
+	bool push (int x)
+		{ return ring.try_push (std::move (x)); }
+	bool pop (int & x)
+		{ return ring.try_pop (x); }
+};
+
+void spsc__bench ()
+{
+	const int len = 1000000;
+	locked_deque deque;
+	ring_queue ring;
+	puts ("spsc__bench # 1M ints through a 1024 deep queue, nsec/element");
+	printf ("%24s %10.2f\n", "mutex + deque", handoff (deque, len) * 1e9 / len);
+	printf ("%24s %10.2f\n", "spsc_ring", handoff (ring, len) * 1e9 / len);
+}
+
+void persist__bench ()
+{
+	const int len = 4000000;
+	const char * path = "persist__bench.tmp";
+	cached_ptr<int, len> ints (len,
+		[] (int i) {
+			return i;
+		});
+	puts ("persist__bench # 4M ints, msec");
+	auto start = bench_clock::now ();
+	{
+		std::ofstream os (path);
+		os << ints;
+	}
+	printf ("%24s %10.2f\n", "operator << write", seconds_since (start) * 1e3);
+	start = bench_clock::now ();
+	save_file (path, ints);
+	printf ("%24s %10.2f\n", "save_file", seconds_since (start) * 1e3);
+	cached_ptr<int, len> loaded;
+	start = bench_clock::now ();
+	load_file (path, loaded);
+	printf ("%24s %10.2f\n", "load_file", seconds_since (start) * 1e3);
+	start = bench_clock::now ();
+	auto mapped = map_file<int, len> (path);
+	printf ("%24s %10.2f\n", "map_file", seconds_since (start) * 1e3);
+	start = bench_clock::now ();
+	long sum = 0;
+	for (size_t i=0; i<mapped.size(); i++)
+		sum += mapped [i];
+	printf ("%24s %10.2f\n", "map_file, first scan", seconds_since (start) * 1e3);
+	if (sum != (long) len * (len - 1) / 2 || !compare (loaded, ints))
+		puts ("...something wrong!");
+	remove (path);
+}
+
+// the element at a time loop operator << used to run.
+template <class T, size_t C>
+double format_each (const cached_ptr<T,C> & vec)
+{
+	std::ostringstream os;
+	auto start = bench_clock::now ();
+	os << "(";
+	for (size_t i=0; i<vec.size(); i++) {
+		if (i)
+			os << ' ';
+		os << vec [i];
+	}
+	os << ")";
+	return seconds_since (start);
+}
+
+template <class T, size_t C>
+double format_all (const cached_ptr<T,C> & vec)
+{
+	std::ostringstream os;
+	auto start = bench_clock::now ();
+	os << vec;
+	return seconds_since (start);
+}
+
+void format__bench ()
+{
+	const int len = 100000;
+	cached_ptr<int, len> ints (len,
+		[] (int i) {
+			return i * 7919;
+		});
+	cached_ptr<double, len> doubles (len,
+		[] (int i) {
+			return i / 7.0;
+		});
+	puts ("format__bench # 100k elements into an ostringstream, msec");
+	printf ("%24s %10s %10s\n", "", "each", "buffered");
+	printf ("%24s %10.2f %10.2f\n", "int", format_each (ints) * 1e3, format_all (ints) * 1e3);
+	printf ("%24s %10.2f %10.2f\n", "double", format_each (doubles) * 1e3, format_all (doubles) * 1e3);
+}
+
+void parse__bench ()
+{
+	const int len = 1000000;
+	const char * path = "parse__bench.tmp";
+	{
+		std::ofstream os (path);
+		for (int i=0; i<len; i++)
+			os << (long) i * 7919 % 1000003 << '\n';
+	}
+	puts ("parse__bench # 1M ints of text, msec");
+
+	// read into a std::vector, then push_back into the cached_ptr
+	auto start = bench_clock::now ();
+	std::vector<int> nums;
+	{
+		std::ifstream is (path);
+		int num;
+		while (is >> num)
+			nums.push_back (num);
+	}
+	cached_ptr<int, len> ints;
+	for (int num : nums)
+		ints.push_back (std::move (num));
+	long sum = 0;
+	for (size_t i=0; i<ints.size(); i++)
+		sum += ints [i];
+	printf ("%24s %10.2f\n", "ifstream + push_back", seconds_since (start) * 1e3);
+
+	start = bench_clock::now ();
+	int fd = open (path, O_RDONLY);
+	text_reader<int, 4096> reader (fd);
+	long sum2 = 0;
+	for_each_chunk (reader, [&sum2] (cached_ptr<int, 4096> && chunk) {
+		for (size_t i=0; i<chunk.size(); i++)
+			sum2 += chunk [i];
+	});
+	close (fd);
+	printf ("%24s %10.2f\n", "text_reader chunks", seconds_since (start) * 1e3);
+	if (sum != sum2 || reader.failed ())
+		puts ("...something wrong!");
+	remove (path);
+}
+
+int main ()
+{
+	// first, before other benches leave faulted pages in the heap.
+	cold_start__bench ();
+	remote_free__bench ();
+	nested__bench ();
+	sort__bench ();
+	sort_by_key__bench ();
+	view__bench ();
+	simd__bench ();
+	drop__bench ();
+	spsc__bench ();
+	persist__bench ();
+	format__bench ();
+	parse__bench ();
+
+	return 0;
+}
@@ -0,0 +1,278 @@
+//
+//  linear_move_2_parallel.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef linear_move_2_parallel_h
+#define linear_move_2_parallel_h
+
+#include <vector>
+
+#include "linear_move_2.h"
+#include "ThreadPool.h"
+
+namespace lm2 {
+
+// below this many elements per chunk the overloads stay on the caller.
+constexpr size_t parallel_grain = 1024;
+
+// a few chunks per thread, so that stealing can even out the load.
+template <class E>
+size_t chunk_count (E & pool, size_t len)
+{
+	size_t chunks = len / parallel_grain;
+	if (chunks > (pool.size() + 1) * 4)
+		chunks = (pool.size() + 1) * 4;
+	return chunks ? chunks : 1;
+}
+
+inline size_t chunk_begin (size_t len, size_t chunks, size_t chunk)
+	{ return len * chunk / chunks; }
+
+template <class E, class F>
+void fork_chunks (E & pool, size_t len, size_t chunks, size_t first, size_t last, F & f)
+{
+	if (last - first == 1) {
+		f (chunk_begin (len, chunks, first), chunk_begin (len, chunks, last), first);
+		return;
+	}
+	size_t mid = (first + last) / 2;
+	pool.join (
+		[&] () { fork_chunks (pool, len, chunks, first, mid, f); },
+		[&] () { fork_chunks (pool, len, chunks, mid, last, f); });
+}
+
+// runs f (begin, end, chunk) for every chunk through E::join and
+// returns once all of them have finished.
+template <class E, class F>
+void parallel_chunks (E & pool, size_t len, size_t chunks, F && f)
+{
+	fork_chunks (pool, len, chunks, 0, chunks, f);
+}
+
+// constructs dst [i] from g (i) in every chunk. if g throws, the
+// elements already built are destroyed before the error goes on.
+template <class R, class E, class G>
+void construct_chunks (E & pool, size_t len, R * dst, G && g)
+{
+	constexpr bool trivial = std::is_trivially_destructible<R>::value;
+	size_t chunks = chunk_count (pool, len);
+	// one flag per chunk that built all of its elements.
+	std::vector<char> built (trivial ? 0 : chunks);
+	try {
+		parallel_chunks (pool, len, chunks,
+			[&] (size_t begin, size_t end, size_t chunk) {
+				size_t i = begin;
+				try {
+					for (; i<end; i++)
+						new (dst + i) R (g (i));
+				} catch (...) {
+					if (!trivial)
+						while (i-- > begin)
+							dst [i].~R();
+					throw;
+				}
+				if (!trivial)
+					built [chunk] = 1;
+			});
+	} catch (...) {
+		for (size_t chunk=0; chunk<built.size(); chunk++)
+			if (built [chunk])
+				for (size_t i=chunk_begin (len, chunks, chunk); i<chunk_begin (len, chunks, chunk + 1); i++)
+					dst [i].~R();
+		throw;
+	}
+}
+
+template <class R, class E, class T, size_t C, class F>
+cached_ptr<R,C> map_to (E & pool, F & f, cached_ptr<T,C> && vec, std::false_type)
+{
+	size_t len = vec.size();
+	cached_ptr<R, C> ret;
+	ret.reserve (len);
+	T * src = vec.data();
+	construct_chunks (pool, len, ret.data(),
+		[&] (size_t i) { return f (std::move (src [i])); });
+	ret.resize_uninitialized (len);
+
+	return std::move (ret);
+}
+
+template <class R, class E, class T, size_t C, class F>
+cached_ptr<T,C> map_to (E & pool, F & f, cached_ptr<T,C> && vec, std::true_type)
+{
+	size_t len = vec.size();
+	T * memory = vec.data();
+	parallel_chunks (pool, len, chunk_count (pool, len),
+		[&] (size_t begin, size_t end, size_t) {
+			for (size_t i=begin; i<end; i++)
+				memory [i] = f (std::move (memory [i]));
+		});
+
+	return std::move (vec);
+}
+
+template <class E, class T, size_t C, class F>
+auto map (E & pool, F && f, cached_ptr<T,C> && vec)
+-> cached_ptr<typename std::result_of<F(T)>::type, C>
+{
+	using R = typename std::result_of<F(T)>::type;
+	return map_to<R> (pool, f, std::move (vec), std::is_same<R, T> ());
+}
+
+template <class E, class T, size_t C, class F>
+auto map_of (E & pool, cached_ptr<T,C> & vec, F && f)
+-> cached_ptr<typename std::result_of<F(T)>::type, C>
+{
+	using R = typename std::result_of<F(T)>::type;
+	size_t len = vec.size();
+	cached_ptr<R, C> ret;
+	ret.reserve (len);
+	T * src = vec.data();
+	construct_chunks (pool, len, ret.data(),
+		[&] (size_t i) { return f (src [i]); });
+	ret.resize_uninitialized (len);
+
+	return std::move (ret);
+}
+
+// each chunk compacts itself, then the kept runs are closed up in order.
+template <class E, class T, size_t C, class F>
+cached_ptr<T,C> filter (E & pool, F && f, cached_ptr<T,C> && vec) {
+	size_t len = vec.size();
+	size_t chunks = chunk_count (pool, len);
+	std::vector<size_t> kept (chunks);
+	T * memory = vec.data();
+	parallel_chunks (pool, len, chunks,
+		[&] (size_t begin, size_t end, size_t chunk) {
+			size_t cnt = begin;
+			for (size_t i=begin; i<end; i++)
+				if (f (memory [i])) {
+					if (cnt != i)
+						memory [cnt] = std::move (memory [i]);
+					cnt++;
+				}
+			kept [chunk] = cnt - begin;
+		});
+	size_t cnt = kept [0];
+	for (size_t c=1; c<chunks; c++) {
+		size_t begin = chunk_begin (len, chunks, c);
+		for (size_t i=0; i<kept [c]; i++)
+			memory [cnt++] = std::move (memory [begin + i]);
+	}
+	vec.resize (cnt);
+
+	return std::move (vec);
+}
+
+// every chunk starts from a copy of acc, so acc must be an identity of g,
+// which then combines the partial results from left to right.
+template <class E, class A, class T, size_t C, class F, class G>
+A fold (E & pool, A && acc, F && f, G && g, cached_ptr<T,C> && vec) {
+	size_t len = vec.size();
+	size_t chunks = chunk_count (pool, len);
+	std::vector<typename std::decay<A>::type> partial (chunks, acc);
+	T * memory = vec.data();
+	parallel_chunks (pool, len, chunks,
+		[&] (size_t begin, size_t end, size_t chunk) {
+			auto & part = partial [chunk];
+			for (size_t i=begin; i<end; i++)
+				part = f (std::move (part), std::move (memory [i]));
+		});
+	acc = std::move (partial [0]);
+	for (size_t c=1; c<chunks; c++)
+		acc = g (std::move (acc), std::move (partial [c]));
+	return std::move (acc);
+}
+
+// f must be associative; each chunk reduces into its first element.
+template <class E, class T, size_t C, class F>
+T reduce (E & pool, F && f, cached_ptr<T,C> && vec) {
+	assert (vec.size());
+	size_t len = vec.size();
+	size_t chunks = chunk_count (pool, len);
+	T * memory = vec.data();
+	parallel_chunks (pool, len, chunks,
+		[&] (size_t begin, size_t end, size_t) {
+			for (size_t i=begin+1; i<end; i++)
+				memory [begin] = f (std::move (memory [begin]), std::move (memory [i]));
+		});
+	T acc = std::move (memory [0]);
+	for (size_t c=1; c<chunks; c++)
+		acc = f (std::move (acc), std::move (memory [chunk_begin (len, chunks, c)]));
+	return std::move (acc);
+}
+
+// keys and per-chunk histograms first, then every chunk scatters
+// its elements straight into the preallocated buckets.
+template <size_t RC, class E, class T, size_t C, class F>
+cached_ptr<cached_ptr<T,C>, RC> assort (E & pool, F && f, cached_ptr <T,C> && vec) {
+	size_t len = vec.size();
+	size_t chunks = chunk_count (pool, len);
+	cached_ptr<size_t, C> keys;
+	keys.reserve (len);
+	size_t * key = keys.data();
+	std::vector<size_t> offsets (chunks * RC);
+	T * memory = vec.data();
+	parallel_chunks (pool, len, chunks,
+		[&] (size_t begin, size_t end, size_t chunk) {
+			size_t * counts = &offsets [chunk * RC];
+			for (size_t i=begin; i<end; i++) {
+				key [i] = f (memory [i]);
+				assert (key [i] < RC);
+				counts [key [i]]++;
+			}
+		});
+	keys.resize_uninitialized (len);
+	cached_ptr<cached_ptr<T,C>, RC> ret;
+	for (size_t j=0; j<RC; j++) {
+		size_t total = 0;
+		for (size_t c=0; c<chunks; c++) {
+			size_t cnt = offsets [c * RC + j];
+			offsets [c * RC + j] = total;
+			total += cnt;
+		}
+		ret.push_back (cached_ptr<T,C>());
+		ret [j].reserve (total);
+		ret [j].resize_uninitialized (total);
+	}
+	parallel_chunks (pool, len, chunks,
+		[&] (size_t begin, size_t end, size_t chunk) {
+			size_t * next = &offsets [chunk * RC];
+			for (size_t i=begin; i<end; i++)
+				new (ret [key [i]].data() + next [key [i]]++) T (std::move (memory [i]));
+		});
+
+	return std::move (ret);
+}
+
+// ranges shorter than this are sorted serially by the thread holding them.
+constexpr size_t parallel_sort_cutoff = 4096;
+
+template <class E, class T, class F>
+void parallel_sort (E & pool, sort_engine<T, F> & self, size_t pos, size_t len, size_t depth) {
+	if (len < parallel_sort_cutoff || !depth) {
+		self.recur (pos, len, depth);
+		return;
+	}
+	size_t l_cnt = self.partition (pos, len);
+	pool.join (
+		[&] () { parallel_sort (pool, self, pos, l_cnt, depth - 1); },
+		[&] () { parallel_sort (pool, self, pos + l_cnt + 1, len - l_cnt - 1, depth - 1); });
+}
+
+template <class E, class T, size_t C, class F>
+cached_ptr<T,C> sort (E & pool, F && f, cached_ptr<T,C> && vec) {
+	size_t len = vec.size();
+	sort_engine<T, F> self = {f, vec.data()};
+	parallel_sort (pool, self, 0, len, self.depth_limit (len));
+	return std::move (vec);
+}
+
+} // namespace
+
+#endif
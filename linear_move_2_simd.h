@@ -0,0 +1,311 @@
+//
+//  linear_move_2_simd.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef linear_move_2_simd_h
+#define linear_move_2_simd_h
+
+#include <cstddef>
+#include <type_traits>
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#define LM2_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace lm2 {
+
+// element types the kernels below take over from the generic loops.
+template <class T>
+using simd_arithmetic = std::integral_constant<bool,
+	std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>;
+
+// predicates the kernels can evaluate ahead of the first hit;
+// find_of, take_while and drop_while recognize them.
+enum class cmp_op { eq, ne, lt, le, gt, ge };
+
+template <cmp_op O, class T>
+struct cmp_not;
+
+template <cmp_op O, class T>
+struct cmp {
+	T value;
+	bool operator () (const T & x) const
+	{
+		switch (O) {
+		case cmp_op::eq: return x == value;
+		case cmp_op::ne: return x != value;
+		case cmp_op::lt: return x < value;
+		case cmp_op::le: return x <= value;
+		case cmp_op::gt: return x > value;
+		default: return x >= value;
+		}
+	}
+	cmp_not<O, T> operator ! () const
+		{ return {*this}; }
+};
+
+// the complement of a compare. NaN fails both x < v and x >= v,
+// so it cannot be turned into the opposite compare.
+template <cmp_op O, class T>
+struct cmp_not {
+	cmp<O, T> pred;
+	bool operator () (const T & x) const
+		{ return !pred (x); }
+};
+
+template <class T> cmp<cmp_op::eq, T> cmp_eq (T value) { return {value}; }
+template <class T> cmp<cmp_op::ne, T> cmp_ne (T value) { return {value}; }
+template <class T> cmp<cmp_op::lt, T> cmp_lt (T value) { return {value}; }
+template <class T> cmp<cmp_op::le, T> cmp_le (T value) { return {value}; }
+template <class T> cmp<cmp_op::gt, T> cmp_gt (T value) { return {value}; }
+template <class T> cmp<cmp_op::ge, T> cmp_ge (T value) { return {value}; }
+
+// whether pred only reads its argument, so the kernels may hand it a
+// copy: compares and callables taking const T & or T. generic and
+// overloaded callables are not inspected and count as mutating.
+template <class A, class T>
+using reads_arg = std::integral_constant<bool,
+	std::is_same<A, T>::value || std::is_same<A, const T &>::value>;
+
+template <class F, class T, class = void>
+struct const_predicate : std::false_type {};
+
+template <class R, class A, class T>
+struct const_predicate<R (*) (A), T> : reads_arg<A, T> {};
+
+template <class M, class T>
+struct const_member_predicate : std::false_type {};
+
+template <class R, class K, class A, class T>
+struct const_member_predicate<R (K::*) (A), T> : reads_arg<A, T> {};
+
+template <class R, class K, class A, class T>
+struct const_member_predicate<R (K::*) (A) const, T> : reads_arg<A, T> {};
+
+template <class F, class T>
+struct const_predicate<F, T, decltype (void (&F::operator ()))>
+	: const_member_predicate<decltype (&F::operator ()), T> {};
+
+// generic kernels, written as independent lanes of L elements so the
+// compiler vectorizes them for whatever target they are inlined into.
+#define LM2_SIMD_INLINE inline __attribute__ ((always_inline))
+
+// integers are summed unsigned, so they wrap instead of overflowing.
+template <class T, bool = std::is_integral<T>::value>
+struct sum_type {
+	using type = T;
+};
+
+template <class T>
+struct sum_type<T, true> {
+	using type = typename std::make_unsigned<T>::type;
+};
+
+template <class T, size_t L>
+LM2_SIMD_INLINE T sum_kernel (const T * p, size_t n)
+{
+	using A = typename sum_type<T>::type;
+	A acc [L] = {};
+	size_t i = 0;
+	for (; i + L <= n; i += L)
+		for (size_t j = 0; j < L; j++)
+			acc [j] += A (p [i + j]);
+	A ret = 0;
+	for (size_t j = 0; j < L; j++)
+		ret += acc [j];
+	for (; i < n; i++)
+		ret += A (p [i]);
+	return T (ret);
+}
+
+template <class T, size_t L, bool Min>
+LM2_SIMD_INLINE T min_max_kernel (const T * p, size_t n)
+{
+	T acc [L];
+	for (size_t j = 0; j < L; j++)
+		acc [j] = p [0];
+	size_t i = 0;
+	for (; i + L <= n; i += L)
+		for (size_t j = 0; j < L; j++)
+			acc [j] = (Min ? p [i + j] < acc [j] : acc [j] < p [i + j]) ? p [i + j] : acc [j];
+	T ret = acc [0];
+	for (size_t j = 1; j < L; j++)
+		ret = (Min ? acc [j] < ret : ret < acc [j]) ? acc [j] : ret;
+	for (; i < n; i++)
+		ret = (Min ? p [i] < ret : ret < p [i]) ? p [i] : ret;
+	return ret;
+}
+
+// tests a whole block before looking for the first hit inside it.
+template <class T, size_t L, class P>
+LM2_SIMD_INLINE size_t find_kernel (const T * p, size_t n, const P & pred)
+{
+	size_t i = 0;
+	for (; i + L <= n; i += L) {
+		unsigned hits = 0;
+		for (size_t j = 0; j < L; j++)
+			hits += pred (p [i + j]) ? 1 : 0;
+		if (hits)
+			break;
+	}
+	for (; i < n; i++)
+		if (pred (p [i]))
+			return i;
+	return n;
+}
+
+// keeps the elements pred accepts, in order; dst may be src.
+template <class T, class P>
+LM2_SIMD_INLINE size_t compact_kernel (T * dst, const T * src, size_t n, P & pred)
+{
+	size_t cnt = 0;
+	for (size_t i = 0; i < n; i++) {
+		T t = src [i];
+		dst [cnt] = t;
+		cnt += pred (t) ? 1 : 0;
+	}
+	return cnt;
+}
+
+// B bytes per vector; every kernel keeps two vectors of lanes in flight.
+template <size_t B>
+struct generic_kernels {
+	template <class T>
+	static T sum (const T * p, size_t n)
+		{ return sum_kernel<T, B * 2 / sizeof (T)> (p, n); }
+	template <class T>
+	static T min (const T * p, size_t n)
+		{ return min_max_kernel<T, B * 2 / sizeof (T), true> (p, n); }
+	template <class T>
+	static T max (const T * p, size_t n)
+		{ return min_max_kernel<T, B * 2 / sizeof (T), false> (p, n); }
+	template <class T, class P>
+	static size_t find (const T * p, size_t n, const P & pred)
+		{ return find_kernel<T, B * 2 / sizeof (T)> (p, n, pred); }
+	template <class T, class P>
+	static size_t compact (T * dst, const T * src, size_t n, P & pred)
+		{ return compact_kernel (dst, src, n, pred); }
+};
+
+#ifdef LM2_SIMD_X86
+
+struct avx2_kernels {
+	template <class T>
+	__attribute__ ((target ("avx2"))) static T sum (const T * p, size_t n)
+		{ return sum_kernel<T, 64 / sizeof (T)> (p, n); }
+	template <class T>
+	__attribute__ ((target ("avx2"))) static T min (const T * p, size_t n)
+		{ return min_max_kernel<T, 64 / sizeof (T), true> (p, n); }
+	template <class T>
+	__attribute__ ((target ("avx2"))) static T max (const T * p, size_t n)
+		{ return min_max_kernel<T, 64 / sizeof (T), false> (p, n); }
+	template <class T, class P>
+	__attribute__ ((target ("avx2"))) static size_t find (const T * p, size_t n, const P & pred)
+		{ return find_kernel<T, 64 / sizeof (T)> (p, n, pred); }
+	template <class T, class P>
+	__attribute__ ((target ("avx2"))) static size_t compact (T * dst, const T * src, size_t n, P & pred)
+		{ return compact_kernel (dst, src, n, pred); }
+};
+
+struct avx512_kernels {
+	template <class T>
+	__attribute__ ((target ("avx512f"))) static T sum (const T * p, size_t n)
+		{ return sum_kernel<T, 128 / sizeof (T)> (p, n); }
+	template <class T>
+	__attribute__ ((target ("avx512f"))) static T min (const T * p, size_t n)
+		{ return min_max_kernel<T, 128 / sizeof (T), true> (p, n); }
+	template <class T>
+	__attribute__ ((target ("avx512f"))) static T max (const T * p, size_t n)
+		{ return min_max_kernel<T, 128 / sizeof (T), false> (p, n); }
+	template <class T, class P>
+	__attribute__ ((target ("avx512f"))) static size_t find (const T * p, size_t n, const P & pred)
+		{ return find_kernel<T, 128 / sizeof (T)> (p, n, pred); }
+	// 4 and 8 byte elements go through vpcompress, one vector at a time.
+	template <class T, class P>
+	__attribute__ ((target ("avx512f"))) static size_t compact (T * dst, const T * src, size_t n, P & pred)
+	{
+		if constexpr (sizeof (T) != 4 && sizeof (T) != 8)
+			return compact_kernel (dst, src, n, pred);
+		else {
+			constexpr size_t L = 64 / sizeof (T);
+			size_t cnt = 0;
+			size_t i = 0;
+			for (; i + L <= n; i += L) {
+				unsigned mask = 0;
+				for (size_t j = 0; j < L; j++)
+					mask |= unsigned (pred (src [i + j]) ? 1 : 0) << j;
+				__m512i v = _mm512_loadu_si512 (src + i);
+				if constexpr (sizeof (T) == 4)
+					_mm512_mask_compressstoreu_epi32 (dst + cnt, __mmask16 (mask), v);
+				else
+					_mm512_mask_compressstoreu_epi64 (dst + cnt, __mmask8 (mask), v);
+				cnt += __builtin_popcount (mask);
+			}
+			return cnt + compact_kernel (dst + cnt, src + i, n - i, pred);
+		}
+	}
+};
+
+#endif
+
+enum class simd_level { generic, avx2, avx512 };
+
+// sse2 is the x86-64 baseline, so generic code already uses it.
+inline simd_level simd_support ()
+{
+#ifdef LM2_SIMD_X86
+	static const simd_level level =
+		__builtin_cpu_supports ("avx512f") ? simd_level::avx512 :
+		__builtin_cpu_supports ("avx2") ? simd_level::avx2 : simd_level::generic;
+	return level;
+#else
+	return simd_level::generic;
+#endif
+}
+
+#ifdef LM2_SIMD_X86
+#define LM2_SIMD_DISPATCH(call) \
+	switch (simd_support ()) { \
+	case simd_level::avx512: return avx512_kernels::call; \
+	case simd_level::avx2: return avx2_kernels::call; \
+	default: return generic_kernels<16>::call; \
+	}
+#else
+#define LM2_SIMD_DISPATCH(call) \
+	return generic_kernels<16>::call;
+#endif
+
+template <class T>
+T simd_sum (const T * p, size_t n)
+	{ LM2_SIMD_DISPATCH (sum (p, n)) }
+
+// n must not be 0.
+template <class T>
+T simd_min (const T * p, size_t n)
+	{ LM2_SIMD_DISPATCH (min (p, n)) }
+
+template <class T>
+T simd_max (const T * p, size_t n)
+	{ LM2_SIMD_DISPATCH (max (p, n)) }
+
+// index of the first element pred accepts, or n.
+template <class T, class P>
+size_t simd_find (const T * p, size_t n, const P & pred)
+	{ LM2_SIMD_DISPATCH (find (p, n, pred)) }
+
+template <class T, class P>
+size_t simd_compact (T * dst, const T * src, size_t n, P & pred)
+	{ LM2_SIMD_DISPATCH (compact (dst, src, n, pred)) }
+
+#undef LM2_SIMD_DISPATCH
+#undef LM2_SIMD_INLINE
+
+} // namespace
+
+#endif
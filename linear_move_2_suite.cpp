@@ -0,0 +1,627 @@
+//
+//  linear_move_2_suite.cpp
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+// every algorithm x element type x size, as lm2, as lm2 with every node
+// going back to the heap, and as std::vector + <algorithm>.
+//
+//   linear_move_2_suite [--max-size N] [--json PATH]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cached_ptr.h"
+#include "linear_move_2.h"
+#include "linear_move_2_test.h"
+
+using namespace lm2;
+
+std::atomic<int> Fuga::copy_cnt (0);
+std::atomic<int> Fuga::life_cnt (0);
+std::atomic<int> Fuga::move_cnt (0);
+std::atomic<int> Hoge::copy_cnt (0);
+std::atomic<int> Hoge::life_cnt (0);
+
+struct pod64 {
+	int num;
+	char pad [60];
+};
+
+bool operator == (const pod64 & x, const pod64 & y) { return x.num == y.num; }
+
+template <class T> T make_elem (int num) { return T (num); }
+template <> pod64 make_elem<pod64> (int num) { return pod64 {num, {}}; }
+
+inline int key_of (int x) { return x; }
+inline int key_of (const Fuga & x) { return x.get_num(); }
+inline int key_of (const Hoge & x) { return x.get_num(); }
+inline int key_of (const pod64 & x) { return x.num; }
+
+template <class T> const char * type_name ();
+template <> const char * type_name<int> () { return "int"; }
+template <> const char * type_name<Fuga> () { return "Fuga"; }
+template <> const char * type_name<Hoge> () { return "Hoge"; }
+template <> const char * type_name<pod64> () { return "pod64"; }
+
+// results land here so that no algorithm can be optimized away.
+static volatile long sink;
+
+// what the timed region is given; most algorithms take the input as it is.
+struct plain_input {
+	template <class T, size_t C>
+	static cached_ptr<T,C> prepare (cached_ptr<T,C> && vec)
+		{ return std::move (vec); }
+	template <class T>
+	static std::vector<T> prepare (std::vector<T> && vec)
+		{ return std::move (vec); }
+};
+
+// the input cut into two halves, each in a vector of the full capacity.
+struct halves_input {
+	template <class T, size_t C>
+	static cached_ptr<cached_ptr<T,C>, 2> prepare (cached_ptr<T,C> && vec)
+		{ return group<C / 2> (std::move (vec)); }
+	template <class T>
+	static std::vector<std::vector<T>> prepare (std::vector<T> && vec)
+	{
+		auto mid = vec.begin () + vec.size() / 2;
+		std::vector<std::vector<T>> ret (2);
+		ret [0].assign (std::make_move_iterator (vec.begin ()), std::make_move_iterator (mid));
+		ret [1].assign (std::make_move_iterator (mid), std::make_move_iterator (vec.end ()));
+		return ret;
+	}
+};
+
+// each algorithm consumes its input and drops whatever it produced.
+struct push_back_algo : plain_input {
+	static const char * name () { return "push_back"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+	{
+		size_t len = vec.size();
+		cached_ptr<T,C> ret;
+		for (size_t i=0; i<len; i++)
+			ret.push_back (std::move (vec [i]));
+		sink = ret.size();
+	}
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::vector<T> ret;
+		for (auto & x : vec)
+			ret.push_back (std::move (x));
+		sink = ret.size();
+	}
+};
+
+struct map_algo : plain_input {
+	static const char * name () { return "map"; }
+	template <class T>
+	static T next (T && x)
+		{ return make_elem<T> (key_of (x) + 1); }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = map (next<T>, std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::transform (std::make_move_iterator (vec.begin ()), std::make_move_iterator (vec.end ()),
+			vec.begin (), next<T>);
+		sink = vec.size();
+	}
+};
+
+struct filter_algo : plain_input {
+	static const char * name () { return "filter"; }
+	template <class T>
+	static bool even (const T & x)
+		{ return key_of (x) % 2 == 0; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = filter (even<T>, std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		vec.erase (std::remove_if (vec.begin (), vec.end (),
+			[] (const T & x) { return !even (x); }), vec.end ());
+		sink = vec.size();
+	}
+};
+
+struct fold_algo : plain_input {
+	static const char * name () { return "fold"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+	{
+		sink = fold (0L, [] (long acc, T && x) { return acc + key_of (x); }, std::move (vec));
+	}
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		sink = std::accumulate (vec.begin (), vec.end (), 0L,
+			[] (long acc, const T & x) { return acc + key_of (x); });
+	}
+};
+
+struct sort_algo : plain_input {
+	static const char * name () { return "sort"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+	{
+		// f (pivot, x), true when x goes first
+		vec = sort ([] (const T & pivot, const T & x) { return key_of (x) < key_of (pivot); },
+			std::move (vec));
+		sink = vec.size();
+	}
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::sort (vec.begin (), vec.end (),
+			[] (const T & x, const T & y) { return key_of (x) < key_of (y); });
+		sink = vec.size();
+	}
+};
+
+struct sort_by_key_algo : plain_input {
+	static const char * name () { return "sort_by_key"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+	{
+		vec = sort_by_key ([] (const T & x) { return key_of (x); }, std::move (vec));
+		sink = vec.size();
+	}
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::stable_sort (vec.begin (), vec.end (),
+			[] (const T & x, const T & y) { return key_of (x) < key_of (y); });
+		sink = vec.size();
+	}
+};
+
+struct reverse_algo : plain_input {
+	static const char * name () { return "reverse"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = reverse (std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::reverse (vec.begin (), vec.end ());
+		sink = vec.size();
+	}
+};
+
+// looks for a key that is never there, so the whole input is scanned.
+struct find_algo : plain_input {
+	static const char * name () { return "find"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = find_of (vec, [] (const T & x) { return key_of (x) < 0; }); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		sink = std::find_if (vec.begin (), vec.end (),
+			[] (const T & x) { return key_of (x) < 0; }) - vec.begin ();
+	}
+};
+
+struct take_algo : plain_input {
+	static const char * name () { return "take"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = take (vec.size() / 2, std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		vec.erase (vec.begin () + vec.size() / 2, vec.end ());
+		sink = vec.size();
+	}
+};
+
+struct drop_algo : plain_input {
+	static const char * name () { return "drop"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = drop (vec.size() / 2, std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		vec.erase (vec.begin (), vec.begin () + vec.size() / 2);
+		sink = vec.size();
+	}
+};
+
+struct assort_algo : plain_input {
+	static const char * name () { return "assort"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+	{
+		auto ret = assort<4> ([] (const T & x) { return size_t (key_of (x) & 3); }, std::move (vec));
+		sink = ret [0].size();
+	}
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::vector<T> ret [4];
+		for (auto & x : vec)
+			ret [key_of (x) & 3].push_back (std::move (x));
+		sink = ret [0].size();
+	}
+};
+
+struct reduce_algo : plain_input {
+	static const char * name () { return "reduce"; }
+	template <class T>
+	static T mix (const T & x, const T & y)
+		{ return make_elem<T> (key_of (x) ^ key_of (y)); }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = key_of (reduce ([] (T && x, T && y) { return mix (x, y); }, std::move (vec))); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		sink = key_of (std::accumulate (vec.begin () + 1, vec.end (), std::move (vec [0]),
+			[] (const T & x, const T & y) { return mix (x, y); }));
+	}
+};
+
+struct map_of_algo : plain_input {
+	static const char * name () { return "map_of"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = map_of (vec, [] (const T & x) { return key_of (x) + 1; }).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::vector<int> ret;
+		ret.reserve (vec.size());
+		for (auto & x : vec)
+			ret.push_back (key_of (x) + 1);
+		sink = ret.size();
+	}
+};
+
+struct fold_of_algo : plain_input {
+	static const char * name () { return "fold_of"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = fold_of (vec, 0L, [] (long acc, const T & x) { return acc + key_of (x); }); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		sink = std::accumulate (vec.begin (), vec.end (), 0L,
+			[] (long acc, const T & x) { return acc + key_of (x); });
+	}
+};
+
+// every key passes, so both scan the whole input.
+struct take_while_algo : plain_input {
+	static const char * name () { return "take_while"; }
+	template <class T>
+	static bool keep (const T & x)
+		{ return key_of (x) >= 0; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = take_while (keep<T>, std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		vec.erase (std::find_if_not (vec.begin (), vec.end (), keep<T>), vec.end ());
+		sink = vec.size();
+	}
+};
+
+struct drop_while_algo : plain_input {
+	static const char * name () { return "drop_while"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = drop_while (take_while_algo::keep<T>, std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		vec.erase (vec.begin (), std::find_if_not (vec.begin (), vec.end (), take_while_algo::keep<T>));
+		sink = vec.size();
+	}
+};
+
+// every group is a vector of the full capacity, so two of them.
+struct group_algo : plain_input {
+	static const char * name () { return "group"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = group<C / 2> (std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+		{ sink = halves_input::prepare (std::move (vec)).size(); }
+};
+
+struct join_algo : halves_input {
+	static const char * name () { return "join"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<cached_ptr<T,C>, 2> && halves)
+		{ sink = join (std::move (halves)).size(); }
+	template <class T>
+	static void std_ (std::vector<std::vector<T>> && halves)
+	{
+		std::vector<T> ret;
+		ret.reserve (halves [0].size() + halves [1].size());
+		for (auto & half : halves)
+			ret.insert (ret.end (), std::make_move_iterator (half.begin ()), std::make_move_iterator (half.end ()));
+		sink = ret.size();
+	}
+};
+
+struct combine_algo : halves_input {
+	static const char * name () { return "combine"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<cached_ptr<T,C>, 2> && halves)
+		{ sink = combine (std::move (halves [0]), std::move (halves [1])).size(); }
+	template <class T>
+	static void std_ (std::vector<std::vector<T>> && halves)
+	{
+		halves [0].insert (halves [0].end (),
+			std::make_move_iterator (halves [1].begin ()), std::make_move_iterator (halves [1].end ()));
+		sink = halves [0].size();
+	}
+};
+
+// the input against an equal copy of itself, so every element is compared.
+struct compare_algo {
+	static const char * name () { return "compare"; }
+	template <class T>
+	static T copy (const T & x)
+		{ return make_elem<T> (key_of (x)); }
+	template <class T, size_t C>
+	static cached_ptr<cached_ptr<T,C>, 2> prepare (cached_ptr<T,C> && vec)
+	{
+		cached_ptr<cached_ptr<T,C>, 2> ret;
+		ret.push_back (map_of (vec, copy<T>));
+		ret.push_back (std::move (vec));
+		return ret;
+	}
+	template <class T>
+	static std::vector<std::vector<T>> prepare (std::vector<T> && vec)
+	{
+		std::vector<std::vector<T>> ret (1);
+		for (auto & x : vec)
+			ret [0].push_back (copy (x));
+		ret.push_back (std::move (vec));
+		return ret;
+	}
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<cached_ptr<T,C>, 2> && vecs)
+		{ sink = compare (vecs [0], vecs [1]); }
+	template <class T>
+	static void std_ (std::vector<std::vector<T>> && vecs)
+		{ sink = vecs [0] == vecs [1]; }
+};
+
+struct shuffle_algo : plain_input {
+	static const char * name () { return "shuffle"; }
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = shuffle (std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		std::random_device rd;
+		std::shuffle (vec.begin (), vec.end (), std::mt19937 (rd ()));
+		sink = vec.size();
+	}
+};
+
+// one element onto a vector one short of full.
+struct append_algo {
+	static const char * name () { return "append"; }
+	template <class T, size_t C>
+	static cached_ptr<T,C> prepare (cached_ptr<T,C> && vec)
+		{ return take (vec.size() - 1, std::move (vec)); }
+	template <class T>
+	static std::vector<T> prepare (std::vector<T> && vec)
+	{
+		vec.pop_back ();
+		return std::move (vec);
+	}
+	template <class T, size_t C>
+	static void lm2 (cached_ptr<T,C> && vec)
+		{ sink = append (make_elem<T> (1), std::move (vec)).size(); }
+	template <class T>
+	static void std_ (std::vector<T> && vec)
+	{
+		vec.push_back (make_elem<T> (1));
+		sink = vec.size();
+	}
+};
+
+enum class impl { lm2, lm2_unpooled, std };
+
+static const char * impl_name (impl i)
+{
+	return i == impl::lm2 ? "lm2" : i == impl::lm2_unpooled ? "lm2_unpooled" : "std";
+}
+
+struct result {
+	const char * algorithm;
+	const char * type;
+	size_t size;
+	impl which;
+	size_t samples;
+	double min_ns;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+};
+
+using bench_clock = std::chrono::steady_clock;
+
+// nearest rank on sorted samples.
+static double percentile (const std::vector<double> & sorted, double p)
+{
+	size_t rank = size_t (p * sorted.size() + 0.5);
+	return sorted [rank ? rank - 1 : 0];
+}
+
+// small sizes get more samples, so every cell costs about the same.
+static size_t sample_count (size_t size)
+{
+	size_t samples = 1000000 / size;
+	return samples < 5 ? 5 : samples > 101 ? 101 : samples;
+}
+
+// the input is built and prepared outside the timed region; tearing down
+// what the algorithm returned, and for lm2_unpooled freeing every node the
+// thread cached, is inside it.
+template <class A, class T, size_t N>
+result run_cell (impl which, const std::vector<int> & keys)
+{
+	size_t samples = sample_count (N);
+	std::vector<double> ns;
+	for (size_t s=0; s<samples; s++) {
+		bench_clock::time_point start;
+		if (which == impl::std) {
+			std::vector<T> vec;
+			vec.reserve (N);
+			for (size_t i=0; i<N; i++)
+				vec.push_back (make_elem<T> (keys [i]));
+			auto input = A::prepare (std::move (vec));
+			start = bench_clock::now ();
+			A::std_ (std::move (input));
+		} else {
+			cached_ptr<T,N> vec;
+			for (size_t i=0; i<N; i++)
+				vec.push_back (make_elem<T> (keys [i]));
+			auto input = A::prepare (std::move (vec));
+			start = bench_clock::now ();
+			A::lm2 (std::move (input));
+			if (which == impl::lm2_unpooled)
+				trim_memory_caches ();
+		}
+		ns.push_back (std::chrono::duration<double, std::nano> (bench_clock::now () - start).count());
+		if (which == impl::lm2_unpooled)
+			trim_memory_caches ();
+	}
+	std::sort (ns.begin (), ns.end ());
+	return {A::name (), type_name<T> (), N, which, samples,
+		ns [0], percentile (ns, 0.5), percentile (ns, 0.9), percentile (ns, 0.99)};
+}
+
+struct suite {
+	size_t max_size;
+	std::vector<int> keys;
+	std::vector<result> results;
+
+	void report (const result & r)
+	{
+		printf ("%-12s %-6s %8zu %-13s %12.0f %12.0f %12.0f %10.2f\n",
+			r.algorithm, r.type, r.size, impl_name (r.which),
+			r.p50_ns, r.p90_ns, r.p99_ns, r.size * 1e3 / r.p50_ns);
+		results.push_back (r);
+	}
+	template <class A, class T, size_t N>
+	void cell ()
+	{
+		if (N > max_size)
+			return;
+		for (impl which : {impl::lm2, impl::lm2_unpooled, impl::std})
+			report (run_cell<A, T, N> (which, keys));
+	}
+	template <class A, class T>
+	void sizes ()
+	{
+		cell<A, T, 10> ();
+		cell<A, T, 100> ();
+		cell<A, T, 1000> ();
+		cell<A, T, 10000> ();
+		cell<A, T, 100000> ();
+		cell<A, T, 1000000> ();
+	}
+	template <class A>
+	void types ()
+	{
+		sizes<A, int> ();
+		sizes<A, Fuga> ();
+		sizes<A, Hoge> ();
+		sizes<A, pod64> ();
+	}
+	void run ()
+	{
+		printf ("%-12s %-6s %8s %-13s %12s %12s %12s %10s\n",
+			"algorithm", "type", "size", "impl", "p50 ns", "p90 ns", "p99 ns", "Melem/s");
+		types<push_back_algo> ();
+		types<map_algo> ();
+		types<filter_algo> ();
+		types<fold_algo> ();
+		types<sort_algo> ();
+		types<sort_by_key_algo> ();
+		types<reverse_algo> ();
+		types<find_algo> ();
+		types<take_algo> ();
+		types<drop_algo> ();
+		types<assort_algo> ();
+		types<reduce_algo> ();
+		types<map_of_algo> ();
+		types<fold_of_algo> ();
+		types<take_while_algo> ();
+		types<drop_while_algo> ();
+		types<group_algo> ();
+		types<join_algo> ();
+		types<combine_algo> ();
+		types<compare_algo> ();
+		types<shuffle_algo> ();
+		types<append_algo> ();
+	}
+	bool write_json (const char * path) const
+	{
+		FILE * file = fopen (path, "w");
+		if (!file)
+			return false;
+		fprintf (file, "[\n");
+		for (size_t i=0; i<results.size(); i++) {
+			const result & r = results [i];
+			fprintf (file, "  {\"algorithm\": \"%s\", \"type\": \"%s\", \"size\": %zu, \"impl\": \"%s\", "
+				"\"samples\": %zu, \"min_ns\": %.0f, \"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+				"\"elements_per_sec\": %.0f}%s\n",
+				r.algorithm, r.type, r.size, impl_name (r.which), r.samples,
+				r.min_ns, r.p50_ns, r.p90_ns, r.p99_ns, r.size * 1e9 / r.p50_ns,
+				i + 1 < results.size() ? "," : "");
+		}
+		fprintf (file, "]\n");
+		return fclose (file) == 0;
+	}
+};
+
+int main (int argc, const char * argv[])
+{
+	suite s;
+	s.max_size = 1000000;
+	const char * json = nullptr;
+	for (int i=1; i+1<argc; i+=2) {
+		if (!strcmp (argv [i], "--max-size"))
+			s.max_size = strtoul (argv [i + 1], nullptr, 10);
+		else if (!strcmp (argv [i], "--json"))
+			json = argv [i + 1];
+	}
+	std::mt19937 mt (1);
+	s.keys.resize (1000000);
+	for (auto & key : s.keys)
+		key = int (mt () >> 1);
+	s.run ();
+	if (json && !s.write_json (json)) {
+		fprintf (stderr, "cannot write %s\n", json);
+		return 1;
+	}
+	return 0;
+}
@@ -4,13 +4,89 @@
 
 #include "linear_move_2_test.h"
 
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
 #include "cached_ptr.h"
+#include "cached_ring.h"
+#include "cached_file.h"
+#include "memory_arena.h"
+#include "linear_move_2_parallel.h"
+#include "linear_move_2_view.h"
 
-int Fuga::copy_cnt = 0;
-int Fuga::life_cnt = 0;
-int Hoge::life_cnt = 0;
-int Hoge::copy_cnt = 0;
+namespace lm2 {
+template <>
+struct memory_chain_traits<36> : memory_chain_defaults {
+	static constexpr size_t max_nodes = 2;
+};
+template <>
+struct memory_chain_traits<44> : memory_chain_defaults {
+	static constexpr unsigned decay_interval = 8;
+};
+template <>
+struct memory_chain_traits<52> : memory_chain_defaults {
+	using backend = arena_backend<huge_pages::none>;
+};
+} // namespace
+
+struct alignas (32) packet {
+	float lanes [8];
+};
+
+struct counter {
+	long count;
+};
+
+struct relocated {
+	int num;
+	static int move_cnt;
+	relocated (int n)
+	: num (n)
+		{}
+	relocated (relocated && self) noexcept
+	: num (self.num)
+		{ move_cnt++; }
+	relocated & operator = (relocated && self)
+		{ num = self.num; move_cnt++; return *this; }
+	bool operator == (const relocated & x) const
+		{ return num == x.num; }
+};
+
+int relocated::move_cnt = 0;
+
+// its operator & is not an address.
+struct tagged {
+	int num;
+	int operator & () const
+		{ return num; }
+	bool operator == (const tagged & x) const
+		{ return num == x.num; }
+};
+
+// small enough to be inline, but kept in a node.
+struct pinned_int {
+	int num;
+};
+
+namespace lm2 {
+template <>
+struct inline_storage<pinned_int, 1> : std::false_type {};
+template <>
+struct cache_line_aligned<counter> : std::true_type {};
+template <>
+struct is_trivially_relocatable<relocated> : std::true_type {};
+} // namespace
+
+std::atomic<int> Fuga::copy_cnt (0);
+std::atomic<int> Fuga::life_cnt (0);
+std::atomic<int> Fuga::move_cnt (0);
+std::atomic<int> Hoge::life_cnt (0);
+std::atomic<int> Hoge::copy_cnt (0);
 
 bool progress__test () {
 	puts ("progress__test");
@@ -183,7 +259,29 @@ bool assort__test ()
 			},
 		make_hoges<100> (8)
 		);
-	return compare (hoges, good);
+	if (!compare (hoges, good))
+		return false;
+	// cached_ptr elements overload operator &
+	auto nested =
+		assort<2> (
+			[] (const cached_ptr<int, 8> & ints) {
+				return ints[0] % 2;
+			},
+		cached_ptr<cached_ptr<int, 8>, 10> {1, 2, 3, 4}
+		);
+	return nested[0].size() == 2 && nested[1].size() == 2 &&
+		nested[0][1][0] == 4 && nested[1][0][0] == 1;
+}
+
+bool compare__test ()
+{
+	puts ("compare__test");
+	cached_ptr<int, 10> ints = {1, 2, 3};
+	cached_ptr<tagged, 10> tags = {tagged {1}, tagged {2}};
+	cached_ptr<tagged, 10> tags2 = {tagged {1}, tagged {2}};
+	cached_ptr<tagged, 10> tags3 = {tagged {1}, tagged {3}};
+	return compare (ints, cached_ptr<int, 10> {1, 2, 3}) && !compare (ints, cached_ptr<int, 10> {1, 2, 4}) &&
+		compare (tags, tags2) && !compare (tags, tags3);
 }
 
 bool combine__test ()
@@ -752,6 +850,1145 @@ void qiita_test () {
 	std::cout << hoges << std::endl;
 }
 
+bool remote_free__test ()
+{
+	puts ("remote_free__test");
+	cached_ptr<int, 7> ints = {1, 2, 3};
+	int * memory = &ints;
+	std::thread ([] (cached_ptr<int, 7> && ints) {
+		cached_ptr<int, 7> dead = std::move (ints);
+	}, std::move (ints)).join ();
+	cached_ptr<int, 7> reused;
+	return &reused == memory;
+}
+
+bool memory_limit__test ()
+{
+	puts ("memory_limit__test");
+	{
+		cached_ptr<int, 9> ints[4];
+	}
+	if (get_memory_chain<36>().size() != 2)
+		return false;
+	trim_memory_cache<36> ();
+	return get_memory_chain<36>().size() == 0;
+}
+
+bool memory_decay__test ()
+{
+	puts ("memory_decay__test");
+	trim_memory_cache<44> ();
+	make_memory_cache<44> (40);
+	for (int i=0; i<8; i++)
+		cached_ptr<int, 11> ints = {i};
+	// pre-warmed nodes stay, a burst past them is given back
+	if (get_memory_chain<44>().size() != 40)
+		return false;
+	{
+		cached_ptr<int, 11> ints[80];
+	}
+	for (int i=0; i<16; i++)
+		cached_ptr<int, 11> ints = {i};
+	size_t size = get_memory_chain<44>().size();
+	if (size < 40 || 80 <= size)
+		return false;
+	// an idle class decays only when asked to, again down to the warm ones
+	for (int i=0; i<8; i++)
+		decay_memory_caches ();
+	size = get_memory_chain<44>().size();
+	return 40 <= size && size <= 41;
+}
+
+bool memory_arena__test ()
+{
+	puts ("memory_arena__test");
+	bool ret = false;
+	// on a thread of its own, so that nodes a memory profile pre-warmed
+	// cannot get in between
+	std::thread ([&ret] () {
+		const size_t size = sizeof (memory_node<52>);
+		make_memory_cache<52> (4);
+		char * begin;
+		char * end;
+		{
+			cached_ptr<int, 13> ints1 = {1};
+			cached_ptr<int, 13> ints2 = {2};
+			if ((char *) &ints1 - (char *) &ints2 != size)
+				return;
+			begin = (char *) &ints2 - size * 2;
+			end = (char *) &ints1 + size;
+		}
+		trim_memory_cache<52> ();
+		cached_ptr<int, 13> ints = {3};
+		char * memory = (char *) &ints;
+		ret = begin <= memory && memory < end && ints[0] == 3;
+	}).join ();
+	return ret;
+}
+
+bool memory_arena_bulk__test ()
+{
+	puts ("memory_arena_bulk__test");
+	using node = memory_node<60>;
+	auto & pool = arena_pool<node, huge_pages::none>::instance ();
+	node * first = pool.allocate ();
+	size_t left = memory_arena::slab_size / sizeof (node) - 1;
+	std::vector<node *> nodes;
+	pool.allocate_bulk (left + 10,
+		[&nodes] (node * n) {
+			nodes.push_back (n);
+		});
+	// the rest of the first slab goes out before a new one is mapped
+	bool ret = nodes.size() == left + 10 && nodes[0] == first + 1 && nodes[left - 1] == first + left;
+	pool.deallocate (first);
+	for (auto n : nodes)
+		pool.deallocate (n);
+	return ret;
+}
+
+bool alignment__test ()
+{
+	puts ("alignment__test");
+	cached_ptr<packet, 10> packets (10,
+		[] (int i) {
+			return packet {{(float) i}};
+		});
+	for (int i=0; i<10; i++)
+		if ((uintptr_t) &packets[i] % alignof (packet) || packets[i].lanes[0] != i)
+			return false;
+	using counter_node = memory_node<sizeof (counter) * 10, cache_line_size>;
+	cached_ptr<counter, 10> counters = {counter {1}};
+	return (uintptr_t) &counters % cache_line_size == 0 &&
+		offsetof (counter_node, memory) == cache_line_size;
+}
+
+bool growable__test ()
+{
+	puts ("growable__test");
+	growable_ptr<Fuga> fugas = {1, 2, 3};
+	if (fugas.capacity() != 8)
+		return false;
+	growable_ptr<Hoge> hoges;
+	for (int i=1; i<=1000; i++)
+		hoges.push_back (Hoge (i));
+	if (hoges.capacity() != 1024 || !compare (hoges, make_hoges<1000> (1000)))
+		return false;
+	growable_ptr<Hoge> steps (3, Hoge (2),
+		[] (const Hoge & hoge) {
+			return Hoge (hoge.get_num() + 2);
+		});
+	if (steps.size() != 3 || steps[2].get_num() != 6)
+		return false;
+	growable_ptr<int> ints = {1, 2};
+	try {
+		ints.reserve (growable_ptr<int>::max_size () + 1);
+		return false;
+	}
+	catch (std::length_error &) {
+	}
+	if (ints.size() != 2 || ints[1] != 2)
+		return false;
+	auto good = make_hoges<1000> (500, 4, 4);
+	auto evens =
+		sort (
+			[] (const Hoge & x, const Hoge & y) {
+				return y.get_num() < x.get_num();
+			},
+		filter (
+			[] (const Hoge & hoge) {
+				return !(hoge.get_num() % 4);
+			},
+		map (
+			[] (Hoge && hoge) {
+				hoge.set_num (hoge.get_num() * 2);
+				return std::move (hoge);
+			},
+		shuffle (
+		std::move (hoges)
+		))));
+	// moved-from vectors are left empty.
+	if (!compare (evens, good) || hoges.size())
+		return false;
+	growable_ptr<Hoge> kept;
+	kept = std::move (evens);
+	return !evens.size() && compare (kept, good);
+}
+
+bool inline_storage__test ()
+{
+	puts ("inline_storage__test");
+	cached_ptr<Fuga> fuga = 5;
+	char * object = (char *) std::addressof (fuga);
+	char * memory = (char *) &fuga;
+	if (memory < object || object + sizeof (fuga) <= memory)
+		return false;
+	cached_ptr<cached_ptr<Fuga>, 100> fugas = {1, 2, 3, 4};
+	auto odds =
+		filter (
+			[] (cached_ptr<Fuga> & fuga) {
+				return fuga->get_num() % 2;
+			},
+		std::move (fugas));
+	cached_ptr<cached_ptr<Fuga>, 100> good = {1, 3};
+	if (!compare (odds, good) || fuga->get_num() != 5)
+		return false;
+	// a move carries inline elements along; node ones stay put.
+	static_assert (inline_storage<int, 4>::value && !inline_storage<int, 100>::value &&
+		!inline_storage<pinned_int, 1>::value, "inline_storage__test");
+	cached_ptr<int, 4> small = {1, 2, 3};
+	const int * small_data = small.data();
+	auto small_moved = std::move (small);
+	cached_ptr<int, 100> large = {1, 2, 3};
+	const int * large_data = large.data();
+	auto large_moved = std::move (large);
+	cached_ptr<pinned_int, 1> pinned = pinned_int {1};
+	const pinned_int * pinned_data = pinned.data();
+	auto pinned_moved = std::move (pinned);
+	return small_moved.data() != small_data && small_moved [2] == 3 &&
+		large_moved.data() == large_data && pinned_moved.data() == pinned_data;
+}
+
+bool parallel__test ()
+{
+	puts ("parallel__test");
+	ThreadPool pool (3);
+	const int len = 10000;
+	auto doubled =
+		map (pool,
+			[] (Hoge && hoge) {
+				return Fuga (hoge.get_num() * 2);
+			},
+		make_hoges<len> (len)
+		);
+	auto good = map (
+			[] (Hoge && hoge) {
+				return Fuga (hoge.get_num() * 2);
+			},
+		make_hoges<len> (len)
+		);
+	if (!compare (doubled, good))
+		return false;
+	auto hoges = make_hoges<len> (len);
+	auto nums = map_of (pool, hoges,
+		[] (const Hoge & hoge) {
+			return hoge.get_num();
+		});
+	if (nums.size() != len || nums [len - 1] != len)
+		return false;
+	auto thirds =
+		filter (pool,
+			[] (const Hoge & hoge) {
+				return !(hoge.get_num() % 3);
+			},
+		std::move (hoges)
+		);
+	if (!compare (thirds, make_hoges<len> (len / 3, 3, 3)))
+		return false;
+	long sum =
+		fold (pool, 0L,
+			[] (long && acc, Hoge && hoge) {
+				return acc + hoge.get_num();
+			},
+			[] (long && acc, long && part) {
+				return acc + part;
+			},
+		make_hoges<len> (len)
+		);
+	if (sum != (long) len * (len + 1) / 2)
+		return false;
+	auto max =
+		reduce (pool,
+			[] (Hoge && x, Hoge && y) {
+				return x.get_num() < y.get_num() ? std::move (y) : std::move (x);
+			},
+		shuffle (
+		make_hoges<len> (len)
+		));
+	if (max.get_num() != len)
+		return false;
+	auto parted =
+		assort<2> (pool,
+			[] (const Hoge & hoge) {
+				return hoge.get_num() % 2 ? 0 : 1;
+			},
+		make_hoges<len> (len)
+		);
+	if (!compare (parted [0], make_hoges<len> (len / 2, 1, 2)) ||
+		!compare (parted [1], make_hoges<len> (len / 2, 2, 2)))
+		return false;
+	// a throw in one chunk destroys what every chunk has built.
+	int lives = Fuga::life_cnt;
+	try {
+		map (pool,
+			[] (Hoge && hoge) {
+				if (hoge.get_num() == len / 2)
+					throw std::runtime_error ("parallel__test");
+				return Fuga (hoge.get_num());
+			},
+		make_hoges<len> (len)
+		);
+		return false;
+	} catch (std::runtime_error &) {
+	}
+	try {
+		map_of (pool, thirds,
+			[] (const Hoge & hoge) {
+				if (hoge.get_num() == len - 1)
+					throw std::runtime_error ("parallel__test");
+				return Fuga (hoge.get_num());
+			});
+		return false;
+	} catch (std::runtime_error &) {
+	}
+	return Fuga::life_cnt == lives;
+}
+
+long join_sum (ThreadPool & pool, long begin, long end)
+{
+	if (end - begin <= 100) {
+		long sum = 0;
+		for (long i=begin; i<end; i++)
+			sum += i;
+		return sum;
+	}
+	long mid = (begin + end) / 2;
+	long left = 0, right = 0;
+	pool.join (
+		[&] () { left = join_sum (pool, begin, mid); },
+		[&] () { right = join_sum (pool, mid, end); });
+	return left + right;
+}
+
+bool pool_join__test ()
+{
+	puts ("pool_join__test");
+	ThreadPool pool (3);
+	const long len = 100000;
+	if (join_sum (pool, 0, len) != len * (len - 1) / 2)
+		return false;
+	auto inner = pool.enqueue ([&] () {
+		return join_sum (pool, 0, len);
+	});
+	return inner.get () == len * (len - 1) / 2;
+}
+
+struct big_task {
+	char pad [200];
+	std::atomic<int> * cnt;
+	void operator () ()
+		{ (*cnt)++; }
+};
+
+bool task_function__test ()
+{
+	puts ("task_function__test");
+	std::atomic<int> cnt (0);
+	auto & chain = get_memory_chain<sizeof (big_task), node_alignment<big_task>::value>();
+	trim_memory_cache<sizeof (big_task), node_alignment<big_task>::value> ();
+	{
+		task_function task (big_task {{}, &cnt});
+		task_function moved = std::move (task);
+		moved ();
+		if (task || chain.size () != 0)
+			return false;
+	}
+	// the large callable lived in a node of its own size class
+	if (chain.size () != 1)
+		return false;
+	{
+		ThreadPool pool (2);
+		for (int i=0; i<100; i++)
+			pool.post (big_task {{}, &cnt});
+		for (int i=0; i<100; i++)
+			pool.post ([&cnt] (int n) { cnt += n; }, 2);
+		auto twice = pool.enqueue ([] (Hoge && hoge) {
+			return hoge.get_num() * 2;
+		}, Hoge (21));
+		if (twice.get () != 42)
+			return false;
+		auto error = pool.enqueue ([] () {
+			throw std::runtime_error ("task_function__test");
+		});
+		try {
+			error.get ();
+			return false;
+		} catch (std::runtime_error &) {
+		}
+	}
+	return cnt == 301;
+}
+
+bool task_orphan__test ()
+{
+	puts ("task_orphan__test");
+	std::atomic<int> cnt (0);
+	std::atomic<bool> go (false);
+	std::future<int> done;
+	{
+		ThreadPool pool (1);
+		// keeps the only worker busy until the submitting thread is gone
+		pool.post ([&go] () {
+			while (!go)
+				std::this_thread::yield ();
+		});
+		std::thread ([&] () {
+			pool.post (big_task {{}, &cnt});
+			done = pool.enqueue ([] (big_task task) {
+				task ();
+				return (* task.cnt).load ();
+			}, big_task {{}, &cnt});
+		}).join ();
+		go = true;
+		if (done.get () != 2)
+			return false;
+	}
+	return cnt == 2;
+}
+
+bool parallel_sort__test ()
+{
+	puts ("parallel_sort__test");
+	ThreadPool pool (3);
+	const int len = 20000;
+	auto less = [] (const Hoge & x, const Hoge & y) {
+		return y.get_num() < x.get_num();
+	};
+	auto hoges =
+		sort (pool, less,
+		shuffle (
+		make_hoges<len> (len)
+		));
+	if (!compare (hoges, make_hoges<len> (len)))
+		return false;
+	// equal keys and the insertion sort tail
+	auto twos =
+		sort (pool, less,
+		map (
+			[] (Hoge && hoge) {
+				return Hoge (hoge.get_num() % 2);
+			},
+		shuffle (
+		make_hoges<len> (len)
+		)));
+	for (int i=0; i<len; i++)
+		if (twos [i].get_num() != (i < len / 2 ? 0 : 1))
+			return false;
+	auto small = sort (pool, less, shuffle (make_hoges<10> (10)));
+	return compare (small, make_hoges<10> (10));
+}
+
+bool introsort__test ()
+{
+	puts ("introsort__test");
+	const int len = 100000;
+	auto less = [] (const Hoge & x, const Hoge & y) {
+		return y.get_num() < x.get_num();
+	};
+	auto good = make_hoges<len> (len);
+	auto sorted = sort (less, make_hoges<len> (len));
+	if (!compare (sorted, good))
+		return false;
+	auto reversed = sort (less, make_hoges<len> (len, len, -1));
+	if (!compare (reversed, good))
+		return false;
+	auto organ = sort (less,
+		combine (
+			make_hoges<len> (len / 2, 1, 2),
+			make_hoges<len> (len / 2, len, -2)
+		));
+	if (!compare (organ, good))
+		return false;
+	// no depth left: the whole range goes through heapsort
+	auto heaped = shuffle (make_hoges<len> (len));
+	sort_engine<Hoge, decltype (less)> self = {less, heaped.data()};
+	self.recur (0, len, 0);
+	return compare (heaped, good);
+}
+
+bool sort_by_key__test ()
+{
+	puts ("sort_by_key__test");
+	const int len = 10000;
+	// keys repeat every 100 numbers, so a stable sort keeps
+	// every run of equal keys in ascending order.
+	auto stable = [] (const cached_ptr<Hoge, len> & hoges, int key_of_first) {
+		for (int i=1; i<len; i++) {
+			const Hoge & x = hoges [i - 1];
+			const Hoge & y = hoges [i];
+			if (x.get_num() % 100 == y.get_num() % 100 && !(x.get_num() < y.get_num()))
+				return false;
+		}
+		return hoges [0].get_num() % 100 == key_of_first;
+	};
+	auto by_int =
+		sort_by_key (
+			[] (const Hoge & hoge) {
+				return hoge.get_num() % 100;
+			},
+		make_hoges<len> (len)
+		);
+	if (!stable (by_int, 0))
+		return false;
+	auto by_signed =
+		sort_by_key (
+			[] (const Hoge & hoge) {
+				return 50 - hoge.get_num() % 100;
+			},
+		make_hoges<len> (len)
+		);
+	if (!stable (by_signed, 99))
+		return false;
+	auto by_double =
+		sort_by_key (
+			[] (const Hoge & hoge) {
+				return (hoge.get_num() % 100) * 0.5;
+			},
+		make_hoges<len> (len)
+		);
+	if (!stable (by_double, 0))
+		return false;
+	auto good = make_hoges<len> (len);
+	auto wide =
+		sort_by_key (
+			[] (const Hoge & hoge) {
+				return (long long) hoge.get_num() << 40;
+			},
+		shuffle (
+		make_hoges<len> (len)
+		));
+	return compare (wide, good);
+}
+
+bool view__test ()
+{
+	puts ("view__test");
+	auto good =
+		filter (
+			[] (const Fuga & fuga) {
+				return fuga.get_num() % 3;
+			},
+		map (
+			[] (Hoge && hoge) {
+				return Fuga (hoge.get_num() * 2);
+			},
+		take_while (
+			[] (const Hoge & hoge) {
+				return hoge.get_num() <= 50;
+			},
+		make_hoges<100> (100)
+		)));
+	auto fugas =
+		view (make_hoges<100> (100))
+		| take_while (
+			[] (const Hoge & hoge) {
+				return hoge.get_num() <= 50;
+			})
+		| map (
+			[] (Hoge && hoge) {
+				return Fuga (hoge.get_num() * 2);
+			})
+		| filter (
+			[] (const Fuga & fuga) {
+				return fuga.get_num() % 3;
+			})
+		| collect ();
+	if (!compare (fugas, good))
+		return false;
+	// borrowed: the elements stay where they are
+	auto hoges = make_hoges<100> (10);
+	long sum =
+		view (hoges)
+		| drop (2)
+		| take (5)
+		| map (
+			[] (const Hoge & hoge) {
+				return hoge.get_num();
+			})
+		| fold (0L,
+			[] (long && acc, int num) {
+				return acc + num;
+			});
+	if (sum != 3 + 4 + 5 + 6 + 7 || !compare (hoges, make_hoges<100> (10)))
+		return false;
+	auto max =
+		view (shuffle (make_hoges<100> (10)))
+		| drop_while (
+			[] (const Hoge & hoge) {
+				return hoge.get_num() != 10;
+			})
+		| reduce (
+			[] (Hoge && x, Hoge && y) {
+				return x.get_num() < y.get_num() ? std::move (y) : std::move (x);
+			});
+	if (max.get_num() != 10)
+		return false;
+	auto nums =
+		view (hoges)
+		| map (
+			[] (const Hoge & hoge) {
+				return hoge.get_num();
+			})
+		| take (3)
+		| collect ();
+	if (!compare (nums, cached_ptr<int,100> {1, 2, 3}) || !compare (hoges, make_hoges<100> (10)))
+		return false;
+	// a borrowing pipeline can be stored and continued more than once.
+	auto stored =
+		view (hoges)
+		| map (
+			[] (const Hoge & hoge) {
+				return hoge.get_num();
+			});
+	auto evens =
+		stored
+		| filter (
+			[] (int num) {
+				return !(num % 2);
+			})
+		| collect ();
+	if (!compare (stored | collect (), cached_ptr<int,100> {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}) ||
+		!compare (evens, cached_ptr<int,100> {2, 4, 6, 8, 10}))
+		return false;
+	// a throwing stage leaves nothing collected alive.
+	int lives = Fuga::life_cnt;
+	try {
+		view (hoges)
+		| map (
+			[] (const Hoge & hoge) {
+				if (hoge.get_num() == 5)
+					throw std::runtime_error ("view__test");
+				return Fuga (hoge.get_num());
+			})
+		| collect ();
+		return false;
+	} catch (std::runtime_error &) {
+	}
+	return Fuga::life_cnt == lives;
+}
+
+bool map_in_place__test ()
+{
+	puts ("map_in_place__test");
+	ThreadPool pool (3);
+	const int len = 10000;
+	auto twice = [] (Fuga && fuga) {
+		fuga.set_num (fuga.get_num() * 2);
+		return std::move (fuga);
+	};
+	auto good = map (
+			[] (Hoge && hoge) {
+				return Fuga (hoge.get_num() * 2);
+			},
+		make_hoges<len> (len)
+		);
+	auto fugas = map (
+			[] (Hoge && hoge) {
+				return Fuga (hoge.get_num());
+			},
+		make_hoges<len> (len)
+		);
+	// one move out of each element for the result, nothing else
+	Fuga * memory = fugas.data();
+	int moves = Fuga::move_cnt;
+	fugas = map (twice, std::move (fugas));
+	if (Fuga::move_cnt - moves != len || fugas.data() != memory)
+		return false;
+	if (!compare (fugas, good))
+		return false;
+	moves = Fuga::move_cnt;
+	fugas = map (pool, twice, std::move (fugas));
+	if (Fuga::move_cnt - moves != len || fugas.data() != memory)
+		return false;
+	return compare (fugas, map (twice, std::move (good)));
+}
+
+template <class K, class T>
+bool simd_kernels__test (const T * nums, size_t len)
+{
+	T sum = 0;
+	T min = nums [0];
+	T max = nums [0];
+	for (size_t i=0; i<len; i++) {
+		sum += nums [i];
+		min = nums [i] < min ? nums [i] : min;
+		max = max < nums [i] ? nums [i] : max;
+	}
+	if (K::sum (nums, len) != sum || K::min (nums, len) != min || K::max (nums, len) != max)
+		return false;
+	for (size_t hit : {size_t (0), size_t (31), len / 2, len - 1}) {
+		T value = nums [hit];
+		size_t first = 0;
+		while (nums [first] != value)
+			first++;
+		if (K::find (nums, len, cmp_eq (value)) != first)
+			return false;
+	}
+	if (K::find (nums, len, cmp_gt (max)) != len)
+		return false;
+	std::vector<T> kept (len);
+	auto odd = [] (T x) { return (long long) x % 2 != 0; };
+	size_t cnt = K::compact (kept.data(), nums, len, odd);
+	for (size_t i=0, j=0; i<len; i++)
+		if (odd (nums [i]) && (j >= cnt || kept [j++] != nums [i]))
+			return false;
+	return true;
+}
+
+template <class T>
+bool simd_levels__test ()
+{
+	const size_t len = 1001;
+	std::vector<T> nums (len);
+	std::mt19937 mt (len);
+	for (auto & num : nums)
+		num = T (int (mt () % 2000) - 1000);
+	if (!simd_kernels__test<generic_kernels<16>> (nums.data(), len))
+		return false;
+#ifdef LM2_SIMD_X86
+	if (__builtin_cpu_supports ("avx2") && !simd_kernels__test<avx2_kernels> (nums.data(), len))
+		return false;
+	if (__builtin_cpu_supports ("avx512f") && !simd_kernels__test<avx512_kernels> (nums.data(), len))
+		return false;
+#endif
+	return true;
+}
+
+bool simd__test ()
+{
+	puts ("simd__test");
+	if (!simd_levels__test<int> () || !simd_levels__test<unsigned> () ||
+		!simd_levels__test<long long> () || !simd_levels__test<short> () ||
+		!simd_levels__test<float> () || !simd_levels__test<double> ())
+		return false;
+	const int len = 1000;
+	auto nums = progress<len> (len, 1, [] (int n) { return n + 1; });
+	if (sum_of (nums) != len * (len + 1) / 2 || min_of (nums) != 1 || max_of (nums) != len)
+		return false;
+	if (fold (0, std::plus<int> (), progress<len> (len, 1, [] (int n) { return n + 1; })) != len * (len + 1) / 2)
+		return false;
+	cached_ptr<int, 4> bigs = {2000000000, 2000000000, 2000000000, 2000000000};
+	if (fold (0L, std::plus<> (), std::move (bigs)) != 8000000000L)
+		return false;
+	int acc = 10;
+	if (fold (acc, std::plus<int> (), cached_ptr<int, 4> {1, 2, 3}) != 16)
+		return false;
+	if (find_of (nums, cmp_ge (500)) != 499 || find_of (nums, cmp_gt (len)) != len)
+		return false;
+	// NaN fails x < 3 and x >= 3 alike; both overloads stop at it
+	auto less = [] (float x) { return x < 3.f; };
+	auto floats = [] () { return cached_ptr<float, 8> {1.f, 2.f, NAN, .5f, 7.f}; };
+	if (take_while (cmp_lt (3.f), floats ()).size() != take_while (less, floats ()).size() ||
+		drop_while (cmp_lt (3.f), floats ()).size() != drop_while (less, floats ()).size() ||
+		take_while (less, floats ()).size() != 2)
+		return false;
+	auto heads = take_while (cmp_le (100), progress<len> (len, 1, [] (int n) { return n + 1; }));
+	if (!compare (heads, progress<len> (100, 1, [] (int n) { return n + 1; })))
+		return false;
+	auto tails = drop_while (cmp_lt (901), std::move (nums));
+	if (!compare (tails, progress<len> (100, 901, [] (int n) { return n + 1; })))
+		return false;
+	auto evens =
+		filter (
+			[] (double x) {
+				return !((int) x % 2);
+			},
+		progress<len> (len, 1.0, [] (double x) { return x + 1; })
+		);
+	if (!compare (evens, progress<len> (len / 2, 2.0, [] (double x) { return x + 2; })))
+		return false;
+	static_assert (const_predicate<cmp_not<cmp_op::lt, int>, int>::value &&
+		!const_predicate<bool (*) (int &), int>::value, "simd__test");
+	// a predicate that rewrites its element must see the element itself.
+	auto doubled =
+		filter (
+			[] (int & x) {
+				x *= 2;
+				return x > len;
+			},
+		progress<len> (len, 1, [] (int n) { return n + 1; })
+		);
+	return compare (doubled, progress<len> (len / 2, len + 2, [] (int n) { return n + 2; }));
+}
+
+bool relocation__test ()
+{
+	puts ("relocation__test");
+	static_assert (is_trivially_relocatable<int>::value && is_trivially_relocatable<Hoge>::value &&
+		!is_trivially_relocatable<Fuga>::value, "relocation__test");
+	auto make = [] (int len, int ini) {
+		cached_ptr<relocated, 100> vec;
+		for (int i=0; i<len; i++)
+			vec.push_back (relocated (ini + i));
+		return vec;
+	};
+	auto nums = [] (const cached_ptr<relocated, 100> & vec) {
+		cached_ptr<int, 100> ret;
+		for (size_t i=0; i<vec.size(); i++)
+			ret.push_back (int (vec [i].num));
+		return ret;
+	};
+	auto head = make (10, 0);
+	auto tail = make (10, 10);
+	auto rest = make (5, 20);
+	auto more = make (10, 0);
+	// nothing below moves an element through its move constructor or assignment
+	relocated::move_cnt = 0;
+	auto vec = drop (2, reverse (combine (std::move (head), std::move (tail))));
+	cached_ptr<cached_ptr<relocated, 100>, 100> vec_vec;
+	vec_vec.push_back (std::move (vec));
+	vec_vec.push_back (std::move (rest));
+	auto joined = join (std::move (vec_vec));
+	auto groups = group<10> (std::move (joined));
+	auto parts =
+		assort<2> (
+			[] (const relocated & x) {
+				return x.num % 2;
+			},
+		std::move (more)
+		);
+	if (relocated::move_cnt)
+		return false;
+	return compare (nums (groups [0]), cached_ptr<int, 100> {17, 16, 15, 14, 13, 12, 11, 10, 9, 8}) &&
+		compare (nums (groups [2]), cached_ptr<int, 100> {22, 23, 24}) &&
+		compare (nums (parts [1]), cached_ptr<int, 100> {1, 3, 5, 7, 9});
+}
+
+bool drop_front__test ()
+{
+	puts ("drop_front__test");
+	auto hoges = make_hoges<100> (100);
+	Hoge * memory = hoges.data();
+	// the rest stays where it was
+	hoges = drop (10, std::move (hoges));
+	hoges = drop_while (
+			[] (const Hoge & hoge) {
+				return hoge.get_num() <= 50;
+			},
+		std::move (hoges));
+	if (hoges.data() != memory + 50 || !compare (hoges, make_hoges<100> (50, 51)))
+		return false;
+	// no room left at the back: the elements move down to the start
+	for (int i=101; i<=150; i++)
+		hoges.push_back (Hoge (i));
+	if (hoges.data() != memory || !compare (hoges, make_hoges<100> (100, 51)))
+		return false;
+	hoges = drop_while (
+			[] (const Hoge &) {
+				return true;
+			},
+		std::move (hoges));
+	if (hoges.size() || hoges.data() != memory)
+		return false;
+	// emptied through resize_uninitialized, the vector starts over too
+	auto ints = drop (5, progress<100> (100, 0, [] (int n) { return n + 1; }));
+	int * ints_start = ints.data() - 5;
+	ints.resize_uninitialized (0);
+	if (ints.data() != ints_start)
+		return false;
+
+	growable_ptr<Hoge> grown;
+	for (int i=1; i<=64; i++)
+		grown.push_back (Hoge (i));
+	Hoge * start = grown.data();
+	grown = drop (60, std::move (grown));
+	if (grown.data() != start + 60 || grown [0].get_num() != 61)
+		return false;
+	for (int i=65; i<=120; i++)
+		grown.push_back (Hoge (i));
+	if (grown.data() != start || grown.size() != 60 || grown [59].get_num() != 120)
+		return false;
+
+	grown = drop (10, std::move (grown));
+	grown.resize (0);
+	if (grown.data() != start)
+		return false;
+
+	// inline storage has no offset to keep
+	if (sizeof (cached_ptr<int,2>) != sizeof (int) * 2 + sizeof (size_t))
+		return false;
+	auto nums = drop (1, cached_ptr<int,3> {1, 2, 3});
+	nums.push_back (4);
+	return compare (nums, cached_ptr<int,3> {2, 3, 4});
+}
+
+bool cached_ring__test ()
+{
+	puts ("cached_ring__test");
+	cached_ring<Hoge, 16> ring;
+	int next = 1;
+	int expect = 1;
+	// goes around the node several times
+	for (int round=0; round<10; round++) {
+		while (!ring.full ())
+			ring.push_back (Hoge (next++));
+		for (int i=0; i<11; i++)
+			if (ring.pop_front ().get_num() != expect++)
+				return false;
+	}
+	if (ring.size () != 5 || ring [0].get_num() != expect || ring [4].get_num() != expect + 4)
+		return false;
+	ring.append (make_hoges<16> (11, next));
+	next += 11;
+	ring.drop (3);
+	expect += 3;
+	// straddles the end of the node
+	auto taken = ring.take (10);
+	if (!compare (taken, make_hoges<16> (10, expect)))
+		return false;
+	expect += 10;
+	return ring.size () == 3 && ring.front ().get_num() == expect && ring.back ().get_num() == next - 1;
+}
+
+bool spsc_ring__test ()
+{
+	puts ("spsc_ring__test");
+	const int len = 100000;
+	spsc_ring<Hoge, 64> ring;
+	ThreadPool pool (1);
+	auto producer = pool.enqueue ([&ring] () {
+		for (int i=1; i<=len; i++) {
+			Hoge hoge (i);
+			while (!ring.try_push (std::move (hoge)))
+				std::this_thread::yield ();
+		}
+	});
+	// a mismatch is only recorded: the producer runs until every element
+	// is taken, and the pool cannot be joined before that.
+	bool ret = true;
+	int expect = 1;
+	growable_ptr<Hoge> batch;
+	while (expect <= len) {
+		Hoge hoge;
+		if (expect % 2 && ring.try_pop (hoge)) {
+			if (hoge.get_num() != expect++)
+				ret = false;
+		} else if (ring.drain (batch, 32)) {
+			for (size_t i=0; i<batch.size(); i++)
+				if (batch [i].get_num() != expect++)
+					ret = false;
+			batch = growable_ptr<Hoge> ();
+		} else
+			std::this_thread::yield ();
+	}
+	producer.get ();
+	return ret;
+}
+
+bool memory_stats__test ()
+{
+	puts ("memory_stats__test");
+	auto & chain = get_memory_chain<1234> ();
+	trim_memory_cache<1234> ();
+	auto before = snapshot_memory_cache<1234> ();
+	auto a = chain.pop ();
+	auto b = chain.pop ();
+	chain.push (a);
+	auto c = chain.pop ();
+	std::thread ([c] () { c->chain->push (c); }).join ();
+	chain.push (b);
+	auto after = snapshot_memory_cache<1234> ();
+	if (after.fresh_pops - before.fresh_pops != 2 ||
+			after.cached_pops - before.cached_pops != 1 ||
+			after.remote_frees - before.remote_frees != 1 ||
+			after.cached != 1 || after.peak_cached < 1 || after.peak_in_use != 2 ||
+			after.bytes != sizeof (memory_node<1234>))
+		return false;
+	// a thread that has exited leaves its counters behind
+	std::thread ([] () {
+		auto & chain = get_memory_chain<1234> ();
+		chain.push (chain.pop ());
+	}).join ();
+	auto retired = snapshot_memory_cache<1234> ();
+	if (retired.fresh_pops - after.fresh_pops != 1 || retired.cached != 1)
+		return false;
+	trim_memory_cache<1234> ();
+	for (auto & stats : snapshot_memory_caches ())
+		if (stats.size == 1234)
+			return stats.stats.cached == 0 && stats.stats.cached_pops == retired.cached_pops;
+	return false;
+}
+
+// a fresh file under $TMPDIR, unlinked however the test ends.
+class temp_file {
+	std::string name;
+public:
+	temp_file (const char * tag)
+	{
+		const char * dir = getenv ("TMPDIR");
+		name = std::string (dir && *dir ? dir : "/tmp") + "/" + tag + ".XXXXXX";
+		int fd = mkstemp (&name [0]);
+		if (fd >= 0)
+			close (fd);
+	}
+	temp_file (const temp_file &) = delete;
+	~temp_file ()
+		{ unlink (name.c_str ()); }
+	const char * path () const
+		{ return name.c_str (); }
+};
+
+bool memory_profile__test ()
+{
+	puts ("memory_profile__test");
+	temp_file file ("memory_profile__test");
+	const char * path = file.path ();
+	std::thread ([] () {
+		cached_ptr<int, 587> ints[3];
+	}).join ();
+	if (!save_memory_profile (path))
+		return false;
+	size_t cached = 0;
+	// a fresh thread that never touched the class gets it pre-warmed
+	std::thread ([path, &cached] () {
+		load_memory_profile (path);
+		cached = get_memory_chain<2348> ().size ();
+	}).join ();
+	remove (path);
+	return cached == 3 && !load_memory_profile (path);
+}
+
+bool cached_file__test ()
+{
+	puts ("cached_file__test");
+	temp_file file ("cached_file__test");
+	const char * path = file.path ();
+	cached_ptr<int, 1000> ints (1000,
+		[] (int i) {
+			return i * 3;
+		});
+	if (!save_file (path, ints))
+		return false;
+	auto mapped = map_file<int, 1000> (path);
+	bool ret = mapped && mapped.size () == 1000 && mapped [999] == 2997 &&
+		(uintptr_t) mapped.data () % cache_line_size == 0;
+	auto copied = mapped.copy ();
+	cached_ptr<int, 1000> loaded = {7};
+	ret = ret && compare (copied, ints) && load_file (path, loaded) && compare (loaded, ints);
+	// the read-only algorithms take the view as it is
+	long sum = 0;
+	for (int i : mapped)
+		sum += i;
+	ret = ret && sum == 3 * 999 * 1000 / 2 && sum_of (mapped) == sum && max_of (mapped) == 2997 &&
+		find_of (mapped, cmp_ge (300)) == 100 && fold_of (mapped, 0L, std::plus<> ()) == sum &&
+		map_of (mapped, [] (int i) { return i / 3; }) [999] == 999;
+	// the header keeps other element types and smaller capacities out,
+	// and a file that does not load leaves the vector alone
+	cached_ptr<float, 1000> floats = {1.5f};
+	ret = ret && !map_file<float, 1000> (path) && !map_file<int, 999> (path) && map_file<int> (path) &&
+		!load_file (path, floats) && floats.size () == 1 && floats [0] == 1.5f;
+	remove (path);
+
+	cached_ptr<packet, growable> packets;
+	for (int i=0; i<100; i++)
+		packets.push_back (packet {{(float) i}});
+	cached_ptr<packet, growable> packets2;
+	ret = ret && save_file (path, packets) && load_file (path, packets2) &&
+		packets2.size () == 100 && packets2 [99].lanes [0] == 99;
+	remove (path);
+	return ret && !map_file<int> (path);
+}
+
+bool text_format__test ()
+{
+	puts ("text_format__test");
+	cached_ptr<double, 20> doubles = {0.5, -1.25, 1e10, 1.0 / 3, 0.0, 123456789.0};
+	// what the element at a time operator << wrote
+	auto expect = [] (std::ostream & os, const auto & vec) {
+		os << "(";
+		for (size_t i=0; i<vec.size(); i++)
+			os << (i ? " " : "") << vec [i];
+		os << ")";
+	};
+	std::ostringstream fast, slow;
+	fast << doubles;
+	expect (slow, doubles);
+	fast << std::setprecision (3) << doubles << std::hex << doubles;
+	slow << std::setprecision (3);
+	expect (slow, doubles);
+	slow << std::hex;
+	expect (slow, doubles);
+	if (fast.str () != slow.str ())
+		return false;
+
+	cached_ptr<int, 20000> ints (20000,
+		[] (int i) {
+			return i - 10000;
+		});
+	std::ostringstream fast_ints, slow_ints;
+	fast_ints << ints;
+	expect (slow_ints, ints);
+	if (fast_ints.str () != slow_ints.str ())
+		return false;
+
+	cached_ptr<int, 20> empty;
+	std::ostringstream previews;
+	previews << preview (ints, 2) << preview (ints, 0) << preview (ints, 10000) << empty;
+	return previews.str () == "(-10000 -9999 ... 9998 9999)(...)" + fast_ints.str () + "()";
+}
+
+bool chunk_reader__test ()
+{
+	puts ("chunk_reader__test");
+	// a pipe hands the reader the text in uneven pieces, splitting numbers
+	int fds [2];
+	if (pipe (fds))
+		return false;
+	std::thread writer ([fd = fds [1]] () {
+		std::string text;
+		for (int i=0; i<20000; i++)
+			text += std::to_string (i * 7 - 5000) + (i % 3 ? ", " : i % 5 ? "\n" : "\t");
+		for (size_t pos=0; pos<text.size(); ) {
+			ssize_t done = write (fd, text.data() + pos, std::min<size_t> (text.size() - pos, 1 + pos % 997));
+			if (done <= 0)
+				break;
+			pos += done;
+		}
+		close (fd);
+	});
+	text_reader<int, 1000> reader (fds [0]);
+	int expect = 0;
+	size_t chunks = 0;
+	bool ret = true;
+	for_each_chunk (reader, [&] (cached_ptr<int, 1000> && chunk) {
+		ret = ret && chunk.size () == 1000;
+		chunks++;
+		for (size_t i=0; i<chunk.size (); i++)
+			ret = ret && chunk [i] == expect++ * 7 - 5000;
+	});
+	writer.join ();
+	close (fds [0]);
+	if (!ret || chunks != 20 || reader.failed ())
+		return false;
+
+	temp_file temp ("chunk_reader__test");
+	const char * path = temp.path ();
+	FILE * file = fopen (path, "w");
+	fputs ("0.5 1e3\n-2.25;x7", file);
+	fclose (file);
+	int fd = open (path, O_RDONLY);
+	text_reader<double, 10> doubles (fd, ';');
+	auto parsed = doubles.next ();
+	ret = parsed.size () == 3 && parsed [1] == 1000 && parsed [2] == -2.25 && doubles.failed ();
+	close (fd);
+
+	// records, with one byte too many at the end
+	file = fopen (path, "w");
+	for (int i=0; i<25; i++)
+		fwrite (&i, sizeof (i), 1, file);
+	fputc (0, file);
+	fclose (file);
+	fd = open (path, O_RDONLY);
+	record_reader<int, 10> records (fd);
+	auto first = records.next ();
+	auto second = records.next ();
+	auto third = records.next ();
+	ret = ret && first.size () == 10 && second [9] == 19 && third.size () == 5 && third [4] == 24 &&
+		records.failed () && !records.next ().size ();
+	close (fd);
+	remove (path);
+	return ret;
+}
+
 bool test_all () {
 	return
 		progress__test () &&
@@ -768,6 +2005,7 @@ bool test_all () {
 		group__test2 () &&
 		join__test () &&
 		assort__test () &&
+		compare__test () &&
 		combine__test () &&
 		filter__test () &&
 		fold__test () &&
@@ -795,6 +2033,33 @@ bool test_all () {
 		compare__ttest2 () &&
 		compare__ftest3 () &&
 		eratosthenes__test () &&
-		eratosthenes_loop__test ();
+		eratosthenes_loop__test () &&
+		remote_free__test () &&
+		memory_limit__test () &&
+		memory_decay__test () &&
+		memory_arena__test () &&
+		memory_arena_bulk__test () &&
+		alignment__test () &&
+		growable__test () &&
+		inline_storage__test () &&
+		parallel__test () &&
+		pool_join__test () &&
+		task_function__test () &&
+		task_orphan__test () &&
+		parallel_sort__test () &&
+		introsort__test () &&
+		sort_by_key__test () &&
+		view__test () &&
+		map_in_place__test () &&
+		simd__test () &&
+		relocation__test () &&
+		drop_front__test () &&
+		cached_ring__test () &&
+		spsc_ring__test () &&
+		memory_stats__test () &&
+		memory_profile__test () &&
+		cached_file__test () &&
+		text_format__test () &&
+		chunk_reader__test ();
 }
 
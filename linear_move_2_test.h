@@ -9,6 +9,8 @@
 #ifndef __fix_test__linear_move_2_test__
 #define __fix_test__linear_move_2_test__
 
+#include <atomic>
+
 #include "linear_move_2.h"
 
 using namespace lm2;
@@ -16,8 +18,9 @@ using namespace lm2;
 class Fuga {
 	int num;
 public:
-	static int copy_cnt;
-	static int life_cnt;
+	static std::atomic<int> copy_cnt;
+	static std::atomic<int> life_cnt;
+	static std::atomic<int> move_cnt;
 	Fuga ()
 	: num (0)
 		{ life_cnt++; }
@@ -31,7 +34,7 @@ public:
 		{ life_cnt--; }
     Fuga(Fuga && self) noexcept
 	: num (std::move (self.num))
-		{ life_cnt++; };
+		{ life_cnt++; move_cnt++; };
     Fuga & operator = (Fuga && self)
 		{ num = std::move(self.num); return *this; }
 	bool operator == (const Fuga & fuga) const
@@ -72,9 +75,15 @@ public:
 		{ return fuga->get_num(); }
 	void set_num (int n)
 		{ return fuga->set_num(n); }
-	static int life_cnt;
-	static int copy_cnt;
+	static std::atomic<int> life_cnt;
+	static std::atomic<int> copy_cnt;
 };
+
+namespace lm2 {
+// all a Hoge holds is its unique_ptr
+template <>
+struct is_trivially_relocatable<Hoge> : std::true_type {};
+} // namespace
 /*
 inline std::ostream& operator<<(std::ostream& os, const uniq <Hoge> & hoge)
 {
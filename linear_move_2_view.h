@@ -0,0 +1,276 @@
+//
+//  linear_move_2_view.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef linear_move_2_view_h
+#define linear_move_2_view_h
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "linear_move_2.h"
+
+namespace lm2 {
+
+// view (vec) | map (g) | filter (f) | take_while (h) | collect ()
+//
+// nothing runs until a sink is applied; then every element is pushed
+// through all the stages in one loop, and only the sink materializes.
+// view (vec &&) owns vec and moves its elements down the pipe,
+// view (vec &) borrows it and hands them down as lvalues.
+
+struct view_stage {};
+struct view_sink {};
+struct view_expr {};
+
+// an element is pushed by calling sink (x); false stops the loop.
+template <class T, size_t C, class E>
+class view_source : public view_expr {
+	using V = typename std::conditional<std::is_reference<E>::value,
+		cached_ptr<T,C> &, cached_ptr<T,C>>::type;
+	V vec;
+public:
+	using value_type = E &&;
+	static constexpr size_t capacity = C;
+
+	view_source (V && vec)
+	: vec (std::forward<V> (vec))
+		{}
+	size_t size () const
+		{ return vec.size (); }
+	template <class K>
+	void run (K && sink) {
+		size_t len = vec.size ();
+		for (size_t i=0; i<len; i++)
+			if (!sink (std::forward<E> (vec [i])))
+				break;
+	}
+};
+
+template <class P, class S>
+class view_stages : public view_expr {
+	P prev;
+	S stage;
+public:
+	using value_type = typename S::template result<typename P::value_type>;
+	static constexpr size_t capacity = P::capacity;
+
+	view_stages (P prev, S stage)
+	: prev (std::move (prev)), stage (std::move (stage))
+		{}
+	size_t size () const
+		{ return prev.size (); }
+	template <class K>
+	void run (K && sink)
+		{ prev.run (stage.bind (sink)); }
+};
+
+template <class T, size_t C>
+view_source<T, C, T> view (cached_ptr<T,C> && vec)
+	{ return view_source<T, C, T> (std::move (vec)); }
+
+template <class T, size_t C>
+view_source<T, C, T &> view (cached_ptr<T,C> & vec)
+	{ return view_source<T, C, T &> (vec); }
+
+// a stored pipeline is copied into the next one; std::move it
+// to hand over an owned source instead.
+template <class P, class S,
+	class D = typename std::decay<P>::type, class T = typename std::decay<S>::type,
+	class = typename std::enable_if<std::is_base_of<view_expr, D>::value &&
+		std::is_base_of<view_stage, T>::value>::type>
+view_stages<D, T> operator | (P && prev, S && stage)
+	{ return view_stages<D, T> (std::forward<P> (prev), std::forward<S> (stage)); }
+
+template <class P, class S,
+	class = typename std::enable_if<std::is_base_of<view_expr, typename std::decay<P>::type>::value &&
+		std::is_base_of<view_sink, typename std::decay<S>::type>::value>::type, class = void>
+auto operator | (P && prev, S && sink)
+	{ return sink.apply (prev); }
+
+template <class G>
+struct map_stage : view_stage {
+	G g;
+	template <class X>
+	using result = typename std::result_of<G&(X)>::type;
+	template <class K>
+	auto bind (K & sink) {
+		return [this, &sink] (auto && x) {
+			return sink (g (std::forward<decltype (x)> (x)));
+		};
+	}
+};
+
+template <class F>
+struct filter_stage : view_stage {
+	F f;
+	template <class X>
+	using result = X;
+	template <class K>
+	auto bind (K & sink) {
+		return [this, &sink] (auto && x) {
+			return f (x) ? sink (std::forward<decltype (x)> (x)) : true;
+		};
+	}
+};
+
+template <class F>
+struct take_while_stage : view_stage {
+	F f;
+	template <class X>
+	using result = X;
+	template <class K>
+	auto bind (K & sink) {
+		return [this, &sink] (auto && x) {
+			return f (x) && sink (std::forward<decltype (x)> (x));
+		};
+	}
+};
+
+template <class F>
+struct drop_while_stage : view_stage {
+	F f;
+	template <class X>
+	using result = X;
+	template <class K>
+	auto bind (K & sink) {
+		return [this, &sink, dropping = true] (auto && x) mutable {
+			if (dropping && f (x))
+				return true;
+			dropping = false;
+			return sink (std::forward<decltype (x)> (x));
+		};
+	}
+};
+
+struct take_stage : view_stage {
+	size_t len;
+	template <class X>
+	using result = X;
+	template <class K>
+	auto bind (K & sink) {
+		return [&sink, len = len] (auto && x) mutable {
+			if (!len)
+				return false;
+			return sink (std::forward<decltype (x)> (x)) && --len;
+		};
+	}
+};
+
+struct drop_stage : view_stage {
+	size_t len;
+	template <class X>
+	using result = X;
+	template <class K>
+	auto bind (K & sink) {
+		return [&sink, len = len] (auto && x) mutable {
+			if (len) {
+				len--;
+				return true;
+			}
+			return sink (std::forward<decltype (x)> (x));
+		};
+	}
+};
+
+template <class G>
+map_stage<typename std::decay<G>::type> map (G && g)
+	{ return {{}, std::forward<G> (g)}; }
+
+template <class F>
+filter_stage<typename std::decay<F>::type> filter (F && f)
+	{ return {{}, std::forward<F> (f)}; }
+
+template <class F>
+take_while_stage<typename std::decay<F>::type> take_while (F && f)
+	{ return {{}, std::forward<F> (f)}; }
+
+template <class F>
+drop_while_stage<typename std::decay<F>::type> drop_while (F && f)
+	{ return {{}, std::forward<F> (f)}; }
+
+inline take_stage take (size_t len)
+	{ return {{}, len}; }
+
+inline drop_stage drop (size_t len)
+	{ return {{}, len}; }
+
+// room for every source element is reserved up front, and whatever
+// comes out of the stages is constructed straight into it. if a stage
+// throws, ret takes the elements built so far and destroys them.
+struct collect_sink : view_sink {
+	template <class P>
+	auto apply (P & expr) {
+		using R = typename std::decay<typename P::value_type>::type;
+		cached_ptr<R, P::capacity> ret;
+		ret.reserve (expr.size ());
+		R * memory = ret.data ();
+		size_t cnt = 0;
+		try {
+			expr.run ([&] (auto && x) {
+				new (memory + cnt) R (std::forward<decltype (x)> (x));
+				cnt++;
+				return true;
+			});
+		} catch (...) {
+			ret.resize_uninitialized (cnt);
+			throw;
+		}
+		ret.resize_uninitialized (cnt);
+		return std::move (ret);
+	}
+};
+
+template <class A, class F>
+struct fold_sink : view_sink {
+	A acc;
+	F f;
+	template <class P>
+	A apply (P & expr) {
+		expr.run ([this] (auto && x) {
+			acc = f (std::move (acc), std::forward<decltype (x)> (x));
+			return true;
+		});
+		return std::move (acc);
+	}
+};
+
+template <class F>
+struct reduce_sink : view_sink {
+	F f;
+	template <class P>
+	auto apply (P & expr) {
+		using R = typename std::decay<typename P::value_type>::type;
+		std::optional<R> acc;
+		expr.run ([&] (auto && x) {
+			if (acc)
+				acc = f (std::move (*acc), std::forward<decltype (x)> (x));
+			else
+				acc.emplace (std::forward<decltype (x)> (x));
+			return true;
+		});
+		assert (acc);
+		return std::move (*acc);
+	}
+};
+
+inline collect_sink collect ()
+	{ return {}; }
+
+template <class A, class F>
+fold_sink<typename std::decay<A>::type, typename std::decay<F>::type> fold (A && acc, F && f)
+	{ return {{}, std::forward<A> (acc), std::forward<F> (f)}; }
+
+template <class F>
+reduce_sink<typename std::decay<F>::type> reduce (F && f)
+	{ return {{}, std::forward<F> (f)}; }
+
+} // namespace
+
+#endif
@@ -7,6 +7,7 @@
 //  http://opensource.org/licenses/mit-license.php
 //
 
+#include <cstring>
 #include <future>
 
 #include "linear_move_2_test.h"
@@ -15,18 +16,12 @@
 
 using namespace lm2;
 
+// `--record` saves what this run needed; later runs pre-warm from it.
+const char * memory_profile = "lm2_memory.profile";
+
 bool do_test (ThreadPool & pool) {
 	pool.enqueue ([](){
-		lm2::make_memory_cache<800>(9);
-		lm2::make_memory_cache<1600>(2);
-		lm2::make_memory_cache<528>(1);
-		lm2::make_memory_cache<400>(3);
-		lm2::make_memory_cache<32>(5);
-		lm2::make_memory_cache<800000>(3);
-		lm2::make_memory_cache<400000>(6);
-		lm2::make_memory_cache<4>(1);
-		lm2::make_memory_cache<800>(1);
-		lm2::make_memory_cache<400>(1);
+		lm2::load_memory_profile (memory_profile);
 	});
 	std::future<cached_ptr<Fuga>> future;
 	future = pool.enqueue ([](){
@@ -60,11 +55,13 @@ int main (int argc, const char * argv[])
 	do_test (pool);
 	
 	foo ();
+	if (argc > 1 && !strcmp (argv [1], "--record"))
+		save_memory_profile (memory_profile);
 	
-	printf ("Fuga::copy_cnt = %d\n", Fuga::copy_cnt);
-	printf ("Fuga::life_cnt = %d\n", Fuga::life_cnt);
-	printf ("Hoge::copy_cnt = %d\n", Hoge::copy_cnt);
-	printf ("Hoge::life_cnt = %d\n", Hoge::life_cnt);
+	printf ("Fuga::copy_cnt = %d\n", Fuga::copy_cnt.load());
+	printf ("Fuga::life_cnt = %d\n", Fuga::life_cnt.load());
+	printf ("Hoge::copy_cnt = %d\n", Hoge::copy_cnt.load());
+	printf ("Hoge::life_cnt = %d\n", Hoge::life_cnt.load());
 	
 	return 0;
 }
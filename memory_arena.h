@@ -0,0 +1,161 @@
+//
+//  memory_arena.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef memory_arena_h
+#define memory_arena_h
+
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cached_ptr.h"
+
+namespace lm2 {
+
+enum class huge_pages {
+	none,
+	transparent,	// madvise (MADV_HUGEPAGE) on every slab
+	hugetlb,	// MAP_HUGETLB, falling back to transparent
+};
+
+// address space handed out by the arena is never unmapped;
+// released nodes keep their address and give back only their pages.
+class memory_arena {
+public:
+	static constexpr size_t slab_size = size_t (2) << 20;
+	static constexpr size_t huge_page_size = size_t (2) << 20;
+
+	static size_t page_size ()
+	{
+		static const size_t size = sysconf (_SC_PAGESIZE);
+		return size;
+	}
+	static size_t round_up (size_t bytes, size_t unit)
+		{ return (bytes + unit - 1) / unit * unit; }
+	static char * map (size_t bytes, huge_pages pages)
+	{
+		void * p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if (pages == huge_pages::hugetlb)
+			p = mmap (nullptr, round_up (bytes, huge_page_size), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (p == MAP_FAILED) {
+			p = mmap (nullptr, round_up (bytes, page_size ()), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::bad_alloc ();
+#ifdef MADV_HUGEPAGE
+			if (pages != huge_pages::none)
+				madvise (p, bytes, MADV_HUGEPAGE);
+#endif
+		}
+		return (char *) p;
+	}
+	// gives back every whole page inside [begin, end).
+	static void release (char * begin, char * end)
+	{
+		size_t page = page_size ();
+		uintptr_t first = round_up ((uintptr_t) begin, page);
+		uintptr_t last = (uintptr_t) end / page * page;
+		if (first < last)
+			madvise ((void *) first, last - first, MADV_DONTNEED);
+	}
+};
+
+template <class N, huge_pages P>
+class arena_pool {
+	std::mutex mutex;
+	char * cur;
+	char * end;
+	N * released;
+
+	arena_pool ()
+	: cur (nullptr), end (nullptr), released (nullptr)
+		{}
+	static constexpr size_t nodes_per_slab ()
+		{ return sizeof (N) < memory_arena::slab_size ? memory_arena::slab_size / sizeof (N) : 1; }
+	N * carve ()
+	{
+		if (cur == end) {
+			cur = memory_arena::map (sizeof (N) * nodes_per_slab (), P);
+			end = cur + sizeof (N) * nodes_per_slab ();
+		}
+		auto node = new (cur) N;
+		cur += sizeof (N);
+		return node;
+	}
+public:
+	static arena_pool & instance ()
+	{
+		static arena_pool pool;
+		return pool;
+	}
+	N * allocate ()
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		if (released) {
+			auto node = released;
+			released = node->next;
+			return node;
+		}
+		return carve ();
+	}
+	// hands out `len` nodes: released ones first, then the rest of the
+	// current slab, then one region for whatever is still missing.
+	template <class F>
+	void allocate_bulk (size_t len, F && f)
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		for (; len && released; len--) {
+			auto node = released;
+			released = node->next;
+			f (node);
+		}
+		for (; len && cur != end; len--)
+			f (carve ());
+		if (len) {
+			size_t cnt = len < nodes_per_slab () ? nodes_per_slab () : len;
+			cur = memory_arena::map (sizeof (N) * cnt, P);
+			end = cur + sizeof (N) * cnt;
+		}
+		for (; len; len--)
+			f (carve ());
+	}
+	void deallocate (N * node)
+	{
+		char * begin = (char *) node;
+		char * header = (char *) &node->next;
+		memory_arena::release (begin, header);
+		memory_arena::release (header + sizeof (node->next), begin + sizeof (N));
+		std::lock_guard<std::mutex> lock (mutex);
+		node->next = released;
+		released = node;
+	}
+};
+
+// select per size class through memory_chain_traits<C>::backend.
+template <huge_pages P = huge_pages::transparent>
+struct arena_backend {
+	template <class N>
+	static N * allocate ()
+		{ return arena_pool<N, P>::instance ().allocate (); }
+	template <class N, class F>
+	static void allocate_bulk (size_t len, F && f)
+		{ arena_pool<N, P>::instance ().allocate_bulk (len, f); }
+	template <class N>
+	static void deallocate (N * node)
+		{ arena_pool<N, P>::instance ().deallocate (node); }
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,129 @@
+//
+//  task_function.h
+//
+//  Copyright (c) 2016 Matsusaki Satoru. All rights reserved.
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+
+#ifndef task_function_h
+#define task_function_h
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "cached_ptr.h"
+
+namespace lm2 {
+
+// move-only void() callable; small callables are kept inline,
+// larger ones in a memory_node of their own size class.
+class task_function {
+public:
+	static constexpr size_t inline_size = 6 * sizeof (void *);
+private:
+	struct ops {
+		void (* call) (void *);
+		// move-constructs into the first buffer and ends the second
+		void (* move) (void *, void *);
+		void (* destroy) (void *);
+	};
+
+	template <class F>
+	struct inline_ops {
+		static void call (void * p)
+			{ (* (F *) p) (); }
+		static void move (void * dst, void * src)
+		{
+			new (dst) F (std::move (* (F *) src));
+			((F *) src)->~F();
+		}
+		static void destroy (void * p)
+			{ ((F *) p)->~F(); }
+		static constexpr ops table = {call, move, destroy};
+	};
+
+	template <class F>
+	struct pooled_ops {
+		using node_type = memory_node<sizeof (F), node_alignment<F>::value>;
+		static F * get (void * p)
+			{ return (F *) (* (node_type **) p)->memory; }
+		static void call (void * p)
+			{ (* get (p)) (); }
+		static void move (void * dst, void * src)
+			{ * (node_type **) dst = * (node_type **) src; }
+		static void destroy (void * p)
+		{
+			auto node = * (node_type **) p;
+			((F *) node->memory)->~F();
+			node->chain->push (node);
+		}
+		static constexpr ops table = {call, move, destroy};
+	};
+
+	template <class F>
+	using fits = std::integral_constant<bool,
+		sizeof (F) <= inline_size &&
+		alignof (F) <= alignof (std::max_align_t) &&
+		std::is_nothrow_move_constructible<F>::value>;
+
+	template <class F, class G>
+	void assign (G && g, std::true_type)
+	{
+		new (buffer) F (std::forward<G> (g));
+		table = &inline_ops<F>::table;
+	}
+	template <class F, class G>
+	void assign (G && g, std::false_type)
+	{
+		auto node = get_memory_chain<sizeof (F), node_alignment<F>::value>().pop();
+		new (node->memory) F (std::forward<G> (g));
+		* (decltype (node) *) buffer = node;
+		table = &pooled_ops<F>::table;
+	}
+
+	alignas (std::max_align_t) char buffer [inline_size];
+	const ops * table;
+public:
+	task_function ()
+	: table (nullptr)
+		{}
+	template <class G, class F = typename std::decay<G>::type,
+		class = typename std::enable_if<!std::is_same<F, task_function>::value>::type>
+	task_function (G && g)
+		{ assign<F> (std::forward<G> (g), fits<F> ()); }
+	task_function (task_function && self) noexcept
+	: table (self.table)
+	{
+		if (table)
+			table->move (buffer, self.buffer);
+		self.table = nullptr;
+	}
+	task_function & operator = (task_function && self) noexcept
+	{
+		reset ();
+		table = self.table;
+		if (table)
+			table->move (buffer, self.buffer);
+		self.table = nullptr;
+		return *this;
+	}
+	~task_function ()
+		{ reset (); }
+	void reset ()
+	{
+		if (table)
+			table->destroy (buffer);
+		table = nullptr;
+	}
+	explicit operator bool () const
+		{ return table; }
+	void operator () ()
+		{ table->call (buffer); }
+};
+
+} // namespace
+
+#endif